@@ -0,0 +1,489 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains a non-blocking interface to a controller, for use in event loops.
+///
+/// The functions nlab_ctrl_submit_*() queue an operation and return immediately with a ticket.
+/// The operations are executed in order by a single worker per controller. Their results are delivered
+/// through a file descriptor, that becomes readable when completions are available and can be added to
+/// epoll, poll or io_uring. The event loop then calls nlab_ctrl_process() to collect the completions.
+///
+/// \code
+/// int fd = nlab_ctrl_get_fd(ctrl, err);
+/// // add fd to the event loop, then:
+/// nlab_ctrl_submit_set_led(ctrl, "led1", true);
+/// // when fd is readable:
+/// nlab_ctrl_completion c[16];
+/// int n = nlab_ctrl_process(ctrl, c, 16);
+/// \endcode
+#ifndef NLAB_CTRL_LIB_ASYNC_H
+#define NLAB_CTRL_LIB_ASYNC_H
+
+// strdup() requires POSIX.
+// Include this header first, or define _POSIX_C_SOURCE yourself.
+#if !defined(_POSIX_C_SOURCE) && !defined(_DEFAULT_SOURCE) && !defined(_GNU_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include <libnlab-ctrl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// \brief Maximum number of queued operations and undelivered completions per controller.
+#ifndef NLAB_CTRL_ASYNC_CAPACITY
+#define NLAB_CTRL_ASYNC_CAPACITY 1024
+#endif
+
+/// \brief Maximum length of a resource id, including the terminating NUL.
+#define NLAB_CTRL_ASYNC_ID_SIZE 48
+
+/// \brief Maximum length of the message of a completion, including the terminating NUL.
+#define NLAB_CTRL_ASYNC_MSG_SIZE 96
+
+/// \brief The result of a submitted operation.
+typedef struct {
+    uint64_t             ticket;                        ///< The ticket returned by the submit function.
+    nlab_ctrl_error_code code;                          ///< The result of the operation.
+    char                 msg[NLAB_CTRL_ASYNC_MSG_SIZE]; ///< The truncated error message, if code is not ::NLAB_CTRL_OK.
+    double               value;                         ///< The result of a getter.
+} nlab_ctrl_completion;
+
+//################//
+//### Internal ###//
+//################//
+
+typedef enum {
+    NLAB_CTRL_ASYNC_SET_STEP_MOTOR_REL_POS_,
+    NLAB_CTRL_ASYNC_SET_STEP_MOTOR_ABS_POS_,
+    NLAB_CTRL_ASYNC_SET_STATUS_LED_,
+    NLAB_CTRL_ASYNC_SET_STATUS_LED_BLINKING_DURATION_,
+    NLAB_CTRL_ASYNC_SET_LED_,
+    NLAB_CTRL_ASYNC_SET_LED_STROBE_,
+    NLAB_CTRL_ASYNC_SET_LED_BRIGHTNESS_,
+    NLAB_CTRL_ASYNC_SET_LED_STROBE_DELAY_,
+    NLAB_CTRL_ASYNC_SET_SWITCH_,
+    NLAB_CTRL_ASYNC_SET_GPIO_PIN_,
+    NLAB_CTRL_ASYNC_GET_SWITCH_,
+    NLAB_CTRL_ASYNC_GET_GPIO_PIN_,
+    NLAB_CTRL_ASYNC_TEMPERATURE_
+} nlab_ctrl_async_op_;
+
+typedef struct {
+    uint64_t            ticket;
+    nlab_ctrl_async_op_ op;
+    char                id[NLAB_CTRL_ASYNC_ID_SIZE];
+    long long int       value;
+} nlab_ctrl_async_request_;
+
+typedef struct nlab_ctrl_async_ {
+    nlab_ctrl*               ctrl;
+    int                      fd;
+    pthread_t                worker;
+    pthread_mutex_t          mx;
+    pthread_cond_t           cv;
+    bool                     stopped;
+    uint64_t                 next_ticket;
+    nlab_ctrl_async_request_ reqs[NLAB_CTRL_ASYNC_CAPACITY];
+    int                      reqs_head, reqs_count;
+    nlab_ctrl_completion     done[NLAB_CTRL_ASYNC_CAPACITY];
+    int                      done_head, done_count;
+    int                      in_flight;
+    int                      refs;
+    struct nlab_ctrl_async_* next;
+} nlab_ctrl_async_;
+
+// The registry of all controllers with an async worker, shared by all translation units.
+// refs of its entries is guarded by mx. nlab_ctrl_async_close() waits on cv until no call uses its entry.
+typedef struct {
+    pthread_mutex_t   mx;
+    pthread_cond_t    cv;
+    nlab_ctrl_async_* head;
+} nlab_ctrl_async_registry;
+
+__attribute__((weak)) nlab_ctrl_async_registry nlab_ctrl_async_registry_ = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL
+};
+
+// Returns the entry of ctrl with an additional reference, that must be released with nlab_ctrl_async_release_().
+static inline nlab_ctrl_async_* nlab_ctrl_async_find_(nlab_ctrl* ctrl) {
+    pthread_mutex_lock(&nlab_ctrl_async_registry_.mx);
+    nlab_ctrl_async_* a = nlab_ctrl_async_registry_.head;
+    while (a != NULL && a->ctrl != ctrl) {
+        a = a->next;
+    }
+    if (a != NULL) {
+        a->refs++;
+    }
+    pthread_mutex_unlock(&nlab_ctrl_async_registry_.mx);
+    return a;
+}
+
+static inline void nlab_ctrl_async_release_(nlab_ctrl_async_* a) {
+    pthread_mutex_lock(&nlab_ctrl_async_registry_.mx);
+    if (--a->refs == 0) {
+        pthread_cond_broadcast(&nlab_ctrl_async_registry_.cv);
+    }
+    pthread_mutex_unlock(&nlab_ctrl_async_registry_.mx);
+}
+
+static inline void nlab_ctrl_async_execute_(nlab_ctrl* ctrl, const nlab_ctrl_async_request_* r, nlab_ctrl_completion* c) {
+    nlab_ctrl_error err = { NLAB_CTRL_OK, NULL };
+    c->ticket = r->ticket;
+    c->value = 0;
+    c->msg[0] = '\0';
+
+    switch (r->op) {
+    case NLAB_CTRL_ASYNC_SET_STEP_MOTOR_REL_POS_:           nlab_ctrl_set_step_motor_rel_pos(ctrl, r->id, (int)r->value, &err); break;
+    case NLAB_CTRL_ASYNC_SET_STEP_MOTOR_ABS_POS_:           nlab_ctrl_set_step_motor_abs_pos(ctrl, r->id, (int)r->value, &err); break;
+    case NLAB_CTRL_ASYNC_SET_STATUS_LED_:                   nlab_ctrl_set_status_led(ctrl, (nlab_ctrl_status_led_state)r->value, &err); break;
+    case NLAB_CTRL_ASYNC_SET_STATUS_LED_BLINKING_DURATION_: nlab_ctrl_set_status_led_blinking_duration(ctrl, r->value, &err); break;
+    case NLAB_CTRL_ASYNC_SET_LED_:                          nlab_ctrl_set_led(ctrl, r->id, r->value != 0, &err); break;
+    case NLAB_CTRL_ASYNC_SET_LED_STROBE_:                   nlab_ctrl_set_led_strobe(ctrl, r->id, r->value != 0, &err); break;
+    case NLAB_CTRL_ASYNC_SET_LED_BRIGHTNESS_:               nlab_ctrl_set_led_brightness(ctrl, r->id, (int)r->value, &err); break;
+    case NLAB_CTRL_ASYNC_SET_LED_STROBE_DELAY_:             nlab_ctrl_set_led_strobe_delay(ctrl, r->id, (int)r->value, &err); break;
+    case NLAB_CTRL_ASYNC_SET_SWITCH_:                       nlab_ctrl_set_switch(ctrl, r->id, r->value != 0, &err); break;
+    case NLAB_CTRL_ASYNC_SET_GPIO_PIN_:                     nlab_ctrl_set_gpio_pin(ctrl, r->id, r->value != 0, &err); break;
+    case NLAB_CTRL_ASYNC_GET_SWITCH_: {
+        nlab_ctrl_switch* sw = nlab_ctrl_get_switch(ctrl, r->id, &err);
+        if (sw != NULL) {
+            c->value = sw->on;
+            nlab_ctrl_switch_free(sw);
+        }
+        break;
+    }
+    case NLAB_CTRL_ASYNC_GET_GPIO_PIN_: {
+        nlab_ctrl_gpio_pin* gp = nlab_ctrl_get_gpio_pin(ctrl, r->id, &err);
+        if (gp != NULL) {
+            c->value = gp->on;
+            nlab_ctrl_gpio_pin_free(gp);
+        }
+        break;
+    }
+    case NLAB_CTRL_ASYNC_TEMPERATURE_: c->value = nlab_ctrl_temperature(ctrl, &err); break;
+    }
+
+    c->code = err.code;
+    if (err.msg != NULL) {
+        strncpy(c->msg, err.msg, NLAB_CTRL_ASYNC_MSG_SIZE - 1);
+        c->msg[NLAB_CTRL_ASYNC_MSG_SIZE - 1] = '\0';
+        free(err.msg);
+    }
+}
+
+static inline void* nlab_ctrl_async_run_(void* arg) {
+    nlab_ctrl_async_* a = (nlab_ctrl_async_*)arg;
+    pthread_mutex_lock(&a->mx);
+    for (;;) {
+        // Wait for a request, and for room to store its completion.
+        while (!a->stopped && (a->reqs_count == 0 || a->done_count == NLAB_CTRL_ASYNC_CAPACITY)) {
+            pthread_cond_wait(&a->cv, &a->mx);
+        }
+        if (a->reqs_count == 0 || a->done_count == NLAB_CTRL_ASYNC_CAPACITY) {
+            break;
+        }
+
+        nlab_ctrl_async_request_ r = a->reqs[a->reqs_head];
+        a->reqs_head = (a->reqs_head + 1) % NLAB_CTRL_ASYNC_CAPACITY;
+        a->reqs_count--;
+        a->in_flight = 1;
+        pthread_mutex_unlock(&a->mx);
+
+        nlab_ctrl_completion c;
+        nlab_ctrl_async_execute_(a->ctrl, &r, &c);
+
+        pthread_mutex_lock(&a->mx);
+        a->done[(a->done_head + a->done_count) % NLAB_CTRL_ASYNC_CAPACITY] = c;
+        a->done_count++;
+        a->in_flight = 0;
+        uint64_t one = 1;
+        ssize_t w = write(a->fd, &one, sizeof(one));
+        (void)w;
+        pthread_cond_broadcast(&a->cv);
+    }
+    pthread_mutex_unlock(&a->mx);
+    return NULL;
+}
+
+static inline uint64_t nlab_ctrl_async_submit_(nlab_ctrl* ctrl, nlab_ctrl_async_op_ op, const_char* id, long long int value) {
+    if (id != NULL && strlen(id) >= NLAB_CTRL_ASYNC_ID_SIZE) {
+        return 0;
+    }
+    nlab_ctrl_async_* a = nlab_ctrl_async_find_(ctrl);
+    if (a == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&a->mx);
+    if (a->stopped || a->reqs_count == NLAB_CTRL_ASYNC_CAPACITY) {
+        pthread_mutex_unlock(&a->mx);
+        nlab_ctrl_async_release_(a);
+        return 0;
+    }
+    nlab_ctrl_async_request_* r = &a->reqs[(a->reqs_head + a->reqs_count) % NLAB_CTRL_ASYNC_CAPACITY];
+    r->ticket = a->next_ticket++;
+    r->op = op;
+    strcpy(r->id, id != NULL ? id : "");
+    r->value = value;
+    a->reqs_count++;
+    uint64_t ticket = r->ticket;
+    pthread_cond_signal(&a->cv);
+    pthread_mutex_unlock(&a->mx);
+    nlab_ctrl_async_release_(a);
+    return ticket;
+}
+
+//###########//
+//### API ###//
+//###########//
+
+/// \brief Returns the file descriptor of the controller, that becomes readable when completions are available.
+///
+/// The first call starts the worker of the controller, all nlab_ctrl_submit_*() functions require this.
+/// The descriptor must not be read from or closed, use nlab_ctrl_process() and nlab_ctrl_async_close().
+///
+/// \param[in]     ctrl       The opened controller.
+/// \param[in,out] ctrl_err   Used to communicate the result of the operation.
+///
+/// \return The file descriptor, or -1, when nlab_ctrl_error::code is not ::NLAB_CTRL_OK.
+static inline int nlab_ctrl_get_fd(nlab_ctrl* ctrl, nlab_ctrl_error* ctrl_err) {
+    pthread_mutex_lock(&nlab_ctrl_async_registry_.mx);
+    nlab_ctrl_async_* a = nlab_ctrl_async_registry_.head;
+    while (a != NULL && a->ctrl != ctrl) {
+        a = a->next;
+    }
+    if (a != NULL) {
+        int fd = a->fd;
+        pthread_mutex_unlock(&nlab_ctrl_async_registry_.mx);
+        return fd;
+    }
+
+    a = (nlab_ctrl_async_*)calloc(1, sizeof(nlab_ctrl_async_));
+    if (a == NULL) {
+        pthread_mutex_unlock(&nlab_ctrl_async_registry_.mx);
+        nlab_ctrl_error_set(ctrl_err, NLAB_CTRL_ERR, strdup("async: out of memory"));
+        return -1;
+    }
+    a->ctrl = ctrl;
+    a->next_ticket = 1;
+    a->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pthread_mutex_init(&a->mx, NULL);
+    pthread_cond_init(&a->cv, NULL);
+    if (a->fd < 0 || pthread_create(&a->worker, NULL, nlab_ctrl_async_run_, a) != 0) {
+        if (a->fd >= 0) {
+            close(a->fd);
+        }
+        free(a);
+        pthread_mutex_unlock(&nlab_ctrl_async_registry_.mx);
+        nlab_ctrl_error_set(ctrl_err, NLAB_CTRL_ERR, strdup("async: failed to start the worker"));
+        return -1;
+    }
+    a->next = nlab_ctrl_async_registry_.head;
+    nlab_ctrl_async_registry_.head = a;
+    int fd = a->fd;
+    pthread_mutex_unlock(&nlab_ctrl_async_registry_.mx);
+    return fd;
+}
+
+/// \brief Collects available completions without blocking.
+///
+/// Completions are delivered in submission order. If more completions are available than fit into completions,
+/// the file descriptor stays readable.
+///
+/// \param[in]   ctrl         The opened controller.
+/// \param[out]  completions  Receives the completions.
+/// \param[in]   size         The number of elements of completions.
+///
+/// \return The number of completions stored, or -1, if nlab_ctrl_get_fd() was not called for ctrl.
+static inline int nlab_ctrl_process(nlab_ctrl* ctrl, nlab_ctrl_completion* completions, int size) {
+    nlab_ctrl_async_* a = nlab_ctrl_async_find_(ctrl);
+    if (a == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&a->mx);
+    uint64_t v;
+    ssize_t r = read(a->fd, &v, sizeof(v));
+    (void)r;
+
+    int n = 0;
+    while (n < size && a->done_count > 0) {
+        completions[n++] = a->done[a->done_head];
+        a->done_head = (a->done_head + 1) % NLAB_CTRL_ASYNC_CAPACITY;
+        a->done_count--;
+    }
+    if (a->done_count > 0) {
+        uint64_t one = 1;
+        ssize_t w = write(a->fd, &one, sizeof(one));
+        (void)w;
+    }
+    pthread_cond_broadcast(&a->cv);
+    pthread_mutex_unlock(&a->mx);
+    nlab_ctrl_async_release_(a);
+    return n;
+}
+
+/// \brief Executes all submitted operations and stops the worker of the controller.
+///
+/// Undelivered completions are dropped. Must be called before nlab_ctrl_close(), if nlab_ctrl_get_fd() was called. \n
+/// Calls running concurrently on other threads finish first, later calls fail as if nlab_ctrl_get_fd() was never called.
+///
+/// \param[in]  ctrl  The opened controller.
+static inline void nlab_ctrl_async_close(nlab_ctrl* ctrl) {
+    pthread_mutex_lock(&nlab_ctrl_async_registry_.mx);
+    nlab_ctrl_async_** p = &nlab_ctrl_async_registry_.head;
+    while (*p != NULL && (*p)->ctrl != ctrl) {
+        p = &(*p)->next;
+    }
+    nlab_ctrl_async_* a = *p;
+    if (a != NULL) {
+        *p = a->next;
+        // Wait until no submit or process call uses the entry anymore, none can find it now.
+        while (a->refs > 0) {
+            pthread_cond_wait(&nlab_ctrl_async_registry_.cv, &nlab_ctrl_async_registry_.mx);
+        }
+    }
+    pthread_mutex_unlock(&nlab_ctrl_async_registry_.mx);
+    if (a == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&a->mx);
+    a->stopped = true;
+    // Drop undelivered completions, so that the worker can drain all requests.
+    a->done_count = 0;
+    pthread_cond_broadcast(&a->cv);
+    while (a->reqs_count > 0 || a->in_flight) {
+        a->done_count = 0;
+        pthread_cond_broadcast(&a->cv);
+        pthread_cond_wait(&a->cv, &a->mx);
+    }
+    pthread_mutex_unlock(&a->mx);
+
+    pthread_join(a->worker, NULL);
+    close(a->fd);
+    pthread_mutex_destroy(&a->mx);
+    pthread_cond_destroy(&a->cv);
+    free(a);
+}
+
+/// \brief Queues nlab_ctrl_set_step_motor_rel_pos().
+///
+/// \return The ticket, or 0, if the queue is full, id is NLAB_CTRL_ASYNC_ID_SIZE bytes or longer,
+///         or nlab_ctrl_get_fd() was not called for ctrl.
+static inline uint64_t nlab_ctrl_submit_set_step_motor_rel_pos(nlab_ctrl* ctrl, const_char* id, int step) {
+    return nlab_ctrl_async_submit_(ctrl, NLAB_CTRL_ASYNC_SET_STEP_MOTOR_REL_POS_, id, step);
+}
+
+/// \brief Queues nlab_ctrl_set_step_motor_abs_pos().
+///
+/// \return The ticket, or 0, if the queue is full, id is NLAB_CTRL_ASYNC_ID_SIZE bytes or longer,
+///         or nlab_ctrl_get_fd() was not called for ctrl.
+static inline uint64_t nlab_ctrl_submit_set_step_motor_abs_pos(nlab_ctrl* ctrl, const_char* id, int step) {
+    return nlab_ctrl_async_submit_(ctrl, NLAB_CTRL_ASYNC_SET_STEP_MOTOR_ABS_POS_, id, step);
+}
+
+/// \brief Queues nlab_ctrl_set_status_led().
+///
+/// \return The ticket, or 0, if the queue is full or nlab_ctrl_get_fd() was not called for ctrl.
+static inline uint64_t nlab_ctrl_submit_set_status_led(nlab_ctrl* ctrl, nlab_ctrl_status_led_state state) {
+    return nlab_ctrl_async_submit_(ctrl, NLAB_CTRL_ASYNC_SET_STATUS_LED_, NULL, state);
+}
+
+/// \brief Queues nlab_ctrl_set_status_led_blinking_duration().
+///
+/// \return The ticket, or 0, if the queue is full or nlab_ctrl_get_fd() was not called for ctrl.
+static inline uint64_t nlab_ctrl_submit_set_status_led_blinking_duration(nlab_ctrl* ctrl, long long int duration) {
+    return nlab_ctrl_async_submit_(ctrl, NLAB_CTRL_ASYNC_SET_STATUS_LED_BLINKING_DURATION_, NULL, duration);
+}
+
+/// \brief Queues nlab_ctrl_set_led().
+///
+/// \return The ticket, or 0, if the queue is full, id is NLAB_CTRL_ASYNC_ID_SIZE bytes or longer,
+///         or nlab_ctrl_get_fd() was not called for ctrl.
+static inline uint64_t nlab_ctrl_submit_set_led(nlab_ctrl* ctrl, const_char* id, bool on) {
+    return nlab_ctrl_async_submit_(ctrl, NLAB_CTRL_ASYNC_SET_LED_, id, on);
+}
+
+/// \brief Queues nlab_ctrl_set_led_strobe().
+///
+/// \return The ticket, or 0, if the queue is full, id is NLAB_CTRL_ASYNC_ID_SIZE bytes or longer,
+///         or nlab_ctrl_get_fd() was not called for ctrl.
+static inline uint64_t nlab_ctrl_submit_set_led_strobe(nlab_ctrl* ctrl, const_char* id, bool on) {
+    return nlab_ctrl_async_submit_(ctrl, NLAB_CTRL_ASYNC_SET_LED_STROBE_, id, on);
+}
+
+/// \brief Queues nlab_ctrl_set_led_brightness().
+///
+/// \return The ticket, or 0, if the queue is full, id is NLAB_CTRL_ASYNC_ID_SIZE bytes or longer,
+///         or nlab_ctrl_get_fd() was not called for ctrl.
+static inline uint64_t nlab_ctrl_submit_set_led_brightness(nlab_ctrl* ctrl, const_char* id, int brightness) {
+    return nlab_ctrl_async_submit_(ctrl, NLAB_CTRL_ASYNC_SET_LED_BRIGHTNESS_, id, brightness);
+}
+
+/// \brief Queues nlab_ctrl_set_led_strobe_delay().
+///
+/// \return The ticket, or 0, if the queue is full, id is NLAB_CTRL_ASYNC_ID_SIZE bytes or longer,
+///         or nlab_ctrl_get_fd() was not called for ctrl.
+static inline uint64_t nlab_ctrl_submit_set_led_strobe_delay(nlab_ctrl* ctrl, const_char* id, int delay) {
+    return nlab_ctrl_async_submit_(ctrl, NLAB_CTRL_ASYNC_SET_LED_STROBE_DELAY_, id, delay);
+}
+
+/// \brief Queues nlab_ctrl_set_switch().
+///
+/// \return The ticket, or 0, if the queue is full, id is NLAB_CTRL_ASYNC_ID_SIZE bytes or longer,
+///         or nlab_ctrl_get_fd() was not called for ctrl.
+static inline uint64_t nlab_ctrl_submit_set_switch(nlab_ctrl* ctrl, const_char* id, bool on) {
+    return nlab_ctrl_async_submit_(ctrl, NLAB_CTRL_ASYNC_SET_SWITCH_, id, on);
+}
+
+/// \brief Queues nlab_ctrl_set_gpio_pin().
+///
+/// \return The ticket, or 0, if the queue is full, id is NLAB_CTRL_ASYNC_ID_SIZE bytes or longer,
+///         or nlab_ctrl_get_fd() was not called for ctrl.
+static inline uint64_t nlab_ctrl_submit_set_gpio_pin(nlab_ctrl* ctrl, const_char* id, bool on) {
+    return nlab_ctrl_async_submit_(ctrl, NLAB_CTRL_ASYNC_SET_GPIO_PIN_, id, on);
+}
+
+/// \brief Queues nlab_ctrl_get_switch(). The completion value is its on state.
+///
+/// \return The ticket, or 0, if the queue is full, id is NLAB_CTRL_ASYNC_ID_SIZE bytes or longer,
+///         or nlab_ctrl_get_fd() was not called for ctrl.
+static inline uint64_t nlab_ctrl_submit_get_switch(nlab_ctrl* ctrl, const_char* id) {
+    return nlab_ctrl_async_submit_(ctrl, NLAB_CTRL_ASYNC_GET_SWITCH_, id, 0);
+}
+
+/// \brief Queues nlab_ctrl_get_gpio_pin(). The completion value is its on state.
+///
+/// \return The ticket, or 0, if the queue is full, id is NLAB_CTRL_ASYNC_ID_SIZE bytes or longer,
+///         or nlab_ctrl_get_fd() was not called for ctrl.
+static inline uint64_t nlab_ctrl_submit_get_gpio_pin(nlab_ctrl* ctrl, const_char* id) {
+    return nlab_ctrl_async_submit_(ctrl, NLAB_CTRL_ASYNC_GET_GPIO_PIN_, id, 0);
+}
+
+/// \brief Queues nlab_ctrl_temperature(). The completion value is the temperature.
+///
+/// \return The ticket, or 0, if the queue is full or nlab_ctrl_get_fd() was not called for ctrl.
+static inline uint64_t nlab_ctrl_submit_temperature(nlab_ctrl* ctrl) {
+    return nlab_ctrl_async_submit_(ctrl, NLAB_CTRL_ASYNC_TEMPERATURE_, NULL, 0);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains an errno-style alternative to passing nlab_ctrl_error objects.
+///
+/// For every API function taking an nlab_ctrl_error, this file offers a variant with the suffix _fast,
+/// that takes no error. Functions without a return value return the nlab_ctrl_error_code instead,
+/// all others return NULL or 0 on failure, like the original. \n
+/// The error of the last failed call on the current thread is kept in thread-local storage
+/// with a fixed-size message buffer and can be retrieved with nlab_ctrl_last_error_code() and
+/// nlab_ctrl_last_error_msg(). It is kept until the next failure on the same thread or nlab_ctrl_last_error_clear().
+///
+/// No error needs to be created or freed. A successful call costs a single comparison on top of the call itself,
+/// and the message of a failed call is copied into the buffer and released immediately.
+#ifndef NLAB_CTRL_LIB_ERRNO_H
+#define NLAB_CTRL_LIB_ERRNO_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <libnlab-ctrl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// \brief Size of the message buffer of the last error, including the terminating NUL.
+///
+/// Longer messages are truncated.
+#define NLAB_CTRL_LAST_ERROR_MSG_SIZE 256
+
+/// \brief The thread-local state shared by all translation units.
+typedef struct {
+    nlab_ctrl_error     err;                                ///< Passed to every call of this thread.
+    nlab_ctrl_error_code code;                              ///< The code of the last failure.
+    char                msg[NLAB_CTRL_LAST_ERROR_MSG_SIZE]; ///< The message of the last failure.
+} nlab_ctrl_last_error_state;
+
+__attribute__((weak)) __thread nlab_ctrl_last_error_state nlab_ctrl_last_error_state_;
+
+/// \brief Returns the code of the last failed call on this thread, or ::NLAB_CTRL_OK.
+static inline nlab_ctrl_error_code nlab_ctrl_last_error_code() {
+    return nlab_ctrl_last_error_state_.code;
+}
+
+/// \brief Returns the message of the last failed call on this thread, or an empty string.
+///
+/// The message is valid until the next failure on this thread.
+static inline const char* nlab_ctrl_last_error_msg() {
+    return nlab_ctrl_last_error_state_.msg;
+}
+
+/// \brief Resets the last error of this thread to ::NLAB_CTRL_OK.
+static inline void nlab_ctrl_last_error_clear() {
+    nlab_ctrl_last_error_state_.code = NLAB_CTRL_OK;
+    nlab_ctrl_last_error_state_.msg[0] = '\0';
+}
+
+/// \brief Prints the last error of this thread.
+///
+/// Prints a formatted string to stdout with a trailing newline.
+static inline void nlab_ctrl_last_error_print() {
+    nlab_ctrl_last_error_state* s = &nlab_ctrl_last_error_state_;
+    if (s->code == NLAB_CTRL_OK) {
+        puts("nlab_ctrl_error: no error");
+    } else if (s->code == NLAB_CTRL_ERR_NOT_FOUND) {
+        printf("nlab_ctrl_error: resource not found\n\t%s\n", s->msg);
+    } else {
+        printf("nlab_ctrl_error: %s\n", s->msg);
+    }
+}
+
+// Moves a failure of the last call into the last error and resets the error passed to the calls.
+// The msg pointer is reset as well, as nlab_ctrl_error_clear() leaves it dangling.
+static inline nlab_ctrl_error_code nlab_ctrl_last_error_take_() {
+    nlab_ctrl_last_error_state* s = &nlab_ctrl_last_error_state_;
+    if (__builtin_expect(s->err.code == NLAB_CTRL_OK, 1)) {
+        return NLAB_CTRL_OK;
+    }
+
+    s->code = s->err.code;
+    if (s->err.msg != NULL) {
+        strncpy(s->msg, s->err.msg, NLAB_CTRL_LAST_ERROR_MSG_SIZE - 1);
+        s->msg[NLAB_CTRL_LAST_ERROR_MSG_SIZE - 1] = '\0';
+        free(s->err.msg);
+    } else {
+        s->msg[0] = '\0';
+    }
+    s->err.code = NLAB_CTRL_OK;
+    s->err.msg = NULL;
+    return s->code;
+}
+
+#define NLAB_CTRL_LAST_ERROR_ (&nlab_ctrl_last_error_state_.err)
+
+// Defines the _fast variant of a function without a return value.
+#define NLAB_CTRL_FAST_VOID_(name, params, args) \
+    static inline nlab_ctrl_error_code name##_fast params { \
+        name args; \
+        return nlab_ctrl_last_error_take_(); \
+    }
+
+// Defines the _fast variant of a function with a return value.
+#define NLAB_CTRL_FAST_(ret, name, params, args) \
+    static inline ret name##_fast params { \
+        ret r = name args; \
+        nlab_ctrl_last_error_take_(); \
+        return r; \
+    }
+
+//#################//
+//### Functions ###//
+//#################//
+
+NLAB_CTRL_FAST_(nlab_ctrl_info_list, nlab_ctrl_list, (), (NLAB_CTRL_LAST_ERROR_))
+NLAB_CTRL_FAST_(nlab_ctrl*, nlab_ctrl_open, (const_char* backend_id, const_char* dev_path, nlab_ctrl_opts opts), (backend_id, dev_path, opts, NLAB_CTRL_LAST_ERROR_))
+
+NLAB_CTRL_FAST_(nlab_ctrl_step_motors, nlab_ctrl_get_step_motors, (nlab_ctrl* ctrl), (ctrl, NLAB_CTRL_LAST_ERROR_))
+NLAB_CTRL_FAST_(nlab_ctrl_step_motor*, nlab_ctrl_get_step_motor, (nlab_ctrl* ctrl, const_char* id), (ctrl, id, NLAB_CTRL_LAST_ERROR_))
+NLAB_CTRL_FAST_VOID_(nlab_ctrl_set_step_motor_rel_pos, (nlab_ctrl* ctrl, const_char* id, int step), (ctrl, id, step, NLAB_CTRL_LAST_ERROR_))
+NLAB_CTRL_FAST_VOID_(nlab_ctrl_set_step_motor_abs_pos, (nlab_ctrl* ctrl, const_char* id, int step), (ctrl, id, step, NLAB_CTRL_LAST_ERROR_))
+
+NLAB_CTRL_FAST_VOID_(nlab_ctrl_set_status_led, (nlab_ctrl* ctrl, nlab_ctrl_status_led_state state), (ctrl, state, NLAB_CTRL_LAST_ERROR_))
+NLAB_CTRL_FAST_VOID_(nlab_ctrl_set_status_led_blinking_duration, (nlab_ctrl* ctrl, long long int duration), (ctrl, duration, NLAB_CTRL_LAST_ERROR_))
+
+NLAB_CTRL_FAST_(nlab_ctrl_leds, nlab_ctrl_get_leds, (nlab_ctrl* ctrl), (ctrl, NLAB_CTRL_LAST_ERROR_))
+NLAB_CTRL_FAST_(nlab_ctrl_led*, nlab_ctrl_get_led, (nlab_ctrl* ctrl, const_char* id), (ctrl, id, NLAB_CTRL_LAST_ERROR_))
+NLAB_CTRL_FAST_VOID_(nlab_ctrl_set_led, (nlab_ctrl* ctrl, const_char* id, bool on), (ctrl, id, on, NLAB_CTRL_LAST_ERROR_))
+NLAB_CTRL_FAST_VOID_(nlab_ctrl_set_led_strobe, (nlab_ctrl* ctrl, const_char* id, bool on), (ctrl, id, on, NLAB_CTRL_LAST_ERROR_))
+NLAB_CTRL_FAST_VOID_(nlab_ctrl_set_led_brightness, (nlab_ctrl* ctrl, const_char* id, int brightness), (ctrl, id, brightness, NLAB_CTRL_LAST_ERROR_))
+NLAB_CTRL_FAST_VOID_(nlab_ctrl_set_led_strobe_delay, (nlab_ctrl* ctrl, const_char* id, int delay), (ctrl, id, delay, NLAB_CTRL_LAST_ERROR_))
+
+NLAB_CTRL_FAST_(nlab_ctrl_switches, nlab_ctrl_get_switches, (nlab_ctrl* ctrl), (ctrl, NLAB_CTRL_LAST_ERROR_))
+NLAB_CTRL_FAST_(nlab_ctrl_switch*, nlab_ctrl_get_switch, (nlab_ctrl* ctrl, const_char* id), (ctrl, id, NLAB_CTRL_LAST_ERROR_))
+NLAB_CTRL_FAST_VOID_(nlab_ctrl_set_switch, (nlab_ctrl* ctrl, const_char* id, bool on), (ctrl, id, on, NLAB_CTRL_LAST_ERROR_))
+
+NLAB_CTRL_FAST_VOID_(nlab_ctrl_enable_gpio_pins, (nlab_ctrl* ctrl), (ctrl, NLAB_CTRL_LAST_ERROR_))
+NLAB_CTRL_FAST_VOID_(nlab_ctrl_disable_gpio_pins, (nlab_ctrl* ctrl), (ctrl, NLAB_CTRL_LAST_ERROR_))
+NLAB_CTRL_FAST_(nlab_ctrl_gpio_pins, nlab_ctrl_get_gpio_pins, (nlab_ctrl* ctrl), (ctrl, NLAB_CTRL_LAST_ERROR_))
+NLAB_CTRL_FAST_(nlab_ctrl_gpio_pin*, nlab_ctrl_get_gpio_pin, (nlab_ctrl* ctrl, const_char* id), (ctrl, id, NLAB_CTRL_LAST_ERROR_))
+NLAB_CTRL_FAST_VOID_(nlab_ctrl_set_gpio_pin, (nlab_ctrl* ctrl, const_char* id, bool on), (ctrl, id, on, NLAB_CTRL_LAST_ERROR_))
+
+NLAB_CTRL_FAST_(float, nlab_ctrl_temperature, (nlab_ctrl* ctrl), (ctrl, NLAB_CTRL_LAST_ERROR_))
+NLAB_CTRL_FAST_VOID_(nlab_ctrl_power_reset, (nlab_ctrl* ctrl), (ctrl, NLAB_CTRL_LAST_ERROR_))
+
+#undef NLAB_CTRL_FAST_
+#undef NLAB_CTRL_FAST_VOID_
+#undef NLAB_CTRL_LAST_ERROR_
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,366 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains a loader that defers loading the library until it is first needed.
+///
+/// Linking against libnlab-ctrl.so starts the embedded Go runtime and registers all backends
+/// before main() runs, even if the process never touches a controller.
+/// Include this header instead of libnlab-ctrl.h and link with `-ldl` instead of `-lnlab-ctrl`.
+/// The whole C API keeps working unchanged, but libnlab-ctrl.so is only loaded by the first call
+/// to nlab_ctrl_list() or nlab_ctrl_open(), or explicitly by nlab_ctrl_warm_up().
+/// The nlab_ctrl_error functions never load the library.
+///
+/// As the runtime starts on the first load, environment variables such as GOMAXPROCS or GOGC
+/// that are set before that still take effect.
+#ifndef NLAB_CTRL_LIB_LAZY_H
+#define NLAB_CTRL_LIB_LAZY_H
+
+// strdup() and CLOCK_MONOTONIC are not declared in strict ISO C modes.
+// Include this header first, or define _POSIX_C_SOURCE yourself.
+#if defined(__STRICT_ANSI__) && !defined(_POSIX_C_SOURCE) && !defined(_DEFAULT_SOURCE) && !defined(_GNU_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include <libnlab-ctrl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// \brief The library loaded, if the environment variable NLAB_CTRL_LIB is not set.
+#define NLAB_CTRL_LAZY_LIB "libnlab-ctrl.so"
+
+/// \brief Timing information about loading the library.
+typedef struct {
+    bool          loaded;     ///< True, if the library has been loaded successfully.
+    long long int load_time;  ///< Nanoseconds spent loading the library, which includes starting its runtime.
+    long long int bind_time;  ///< Nanoseconds spent resolving the library's functions.
+} nlab_ctrl_startup_stats;
+
+// X-macro of all library functions that return a value.
+// Arguments: return type, name, parameters, arguments, value returned if the library is not loaded.
+#define NLAB_CTRL_LAZY_FUNCS(X) \
+    X(nlab_ctrl_info_list,   nlab_ctrl_list,                 (nlab_ctrl_error* ctrl_err), (ctrl_err), NULL) \
+    X(nlab_ctrl*,            nlab_ctrl_open,                 (const_char* backend_id, const_char* dev_path, nlab_ctrl_opts opts, nlab_ctrl_error* ctrl_err), (backend_id, dev_path, opts, ctrl_err), NULL) \
+    X(nlab_ctrl_step_motors, nlab_ctrl_get_step_motors,      (nlab_ctrl* ctrl, nlab_ctrl_error* ctrl_err), (ctrl, ctrl_err), NULL) \
+    X(nlab_ctrl_step_motor*, nlab_ctrl_get_step_motor,       (nlab_ctrl* ctrl, const_char* id, nlab_ctrl_error* ctrl_err), (ctrl, id, ctrl_err), NULL) \
+    X(nlab_ctrl_leds,        nlab_ctrl_get_leds,             (nlab_ctrl* ctrl, nlab_ctrl_error* ctrl_err), (ctrl, ctrl_err), NULL) \
+    X(nlab_ctrl_led*,        nlab_ctrl_get_led,              (nlab_ctrl* ctrl, const_char* id, nlab_ctrl_error* ctrl_err), (ctrl, id, ctrl_err), NULL) \
+    X(nlab_ctrl_switches,    nlab_ctrl_get_switches,         (nlab_ctrl* ctrl, nlab_ctrl_error* ctrl_err), (ctrl, ctrl_err), NULL) \
+    X(nlab_ctrl_switch*,     nlab_ctrl_get_switch,           (nlab_ctrl* ctrl, const_char* id, nlab_ctrl_error* ctrl_err), (ctrl, id, ctrl_err), NULL) \
+    X(_Bool,                 nlab_ctrl_gpio_pins_enabled,    (nlab_ctrl* ctrl), (ctrl), false) \
+    X(nlab_ctrl_gpio_pins,   nlab_ctrl_get_gpio_pins,        (nlab_ctrl* ctrl, nlab_ctrl_error* ctrl_err), (ctrl, ctrl_err), NULL) \
+    X(nlab_ctrl_gpio_pin*,   nlab_ctrl_get_gpio_pin,         (nlab_ctrl* ctrl, const_char* id, nlab_ctrl_error* ctrl_err), (ctrl, id, ctrl_err), NULL) \
+    X(float,                 nlab_ctrl_temperature,          (nlab_ctrl* ctrl, nlab_ctrl_error* ctrl_err), (ctrl, ctrl_err), 0) \
+    X(int,                   nlab_ctrl_info_list_size,       (nlab_ctrl_info_list infl), (infl), 0) \
+    X(nlab_ctrl_info*,       nlab_ctrl_info_list_at_index,   (nlab_ctrl_info_list infl, int index), (infl, index), NULL) \
+    X(int,                   nlab_ctrl_step_motors_size,     (nlab_ctrl_step_motors sms), (sms), 0) \
+    X(nlab_ctrl_step_motor*, nlab_ctrl_step_motors_at_index, (nlab_ctrl_step_motors sms, int index), (sms, index), NULL) \
+    X(int,                   nlab_ctrl_leds_size,            (nlab_ctrl_leds leds), (leds), 0) \
+    X(nlab_ctrl_led*,        nlab_ctrl_leds_at_index,        (nlab_ctrl_leds leds, int index), (leds, index), NULL) \
+    X(int,                   nlab_ctrl_switches_size,        (nlab_ctrl_switches sws), (sws), 0) \
+    X(nlab_ctrl_switch*,     nlab_ctrl_switches_at_index,    (nlab_ctrl_switches sws, int index), (sws, index), NULL) \
+    X(int,                   nlab_ctrl_gpio_pins_size,       (nlab_ctrl_gpio_pins gps), (gps), 0) \
+    X(nlab_ctrl_gpio_pin*,   nlab_ctrl_gpio_pins_at_index,   (nlab_ctrl_gpio_pins gps, int index), (gps, index), NULL)
+
+// X-macro of all library functions that return void.
+// Arguments: name, parameters, arguments.
+#define NLAB_CTRL_LAZY_VOID_FUNCS(X) \
+    X(nlab_ctrl_set_step_motor_rel_pos,           (nlab_ctrl* ctrl, const_char* id, int step, nlab_ctrl_error* ctrl_err), (ctrl, id, step, ctrl_err)) \
+    X(nlab_ctrl_set_step_motor_abs_pos,           (nlab_ctrl* ctrl, const_char* id, int step, nlab_ctrl_error* ctrl_err), (ctrl, id, step, ctrl_err)) \
+    X(nlab_ctrl_set_status_led,                   (nlab_ctrl* ctrl, nlab_ctrl_status_led_state state, nlab_ctrl_error* ctrl_err), (ctrl, state, ctrl_err)) \
+    X(nlab_ctrl_set_status_led_blinking_duration, (nlab_ctrl* ctrl, long long int duration, nlab_ctrl_error* ctrl_err), (ctrl, duration, ctrl_err)) \
+    X(nlab_ctrl_set_led,                          (nlab_ctrl* ctrl, const_char* id, _Bool on, nlab_ctrl_error* ctrl_err), (ctrl, id, on, ctrl_err)) \
+    X(nlab_ctrl_set_led_strobe,                   (nlab_ctrl* ctrl, const_char* id, _Bool on, nlab_ctrl_error* ctrl_err), (ctrl, id, on, ctrl_err)) \
+    X(nlab_ctrl_set_led_brightness,               (nlab_ctrl* ctrl, const_char* id, int brightness, nlab_ctrl_error* ctrl_err), (ctrl, id, brightness, ctrl_err)) \
+    X(nlab_ctrl_set_led_strobe_delay,             (nlab_ctrl* ctrl, const_char* id, int delay, nlab_ctrl_error* ctrl_err), (ctrl, id, delay, ctrl_err)) \
+    X(nlab_ctrl_set_switch,                       (nlab_ctrl* ctrl, const_char* id, _Bool on, nlab_ctrl_error* ctrl_err), (ctrl, id, on, ctrl_err)) \
+    X(nlab_ctrl_enable_gpio_pins,                 (nlab_ctrl* ctrl, nlab_ctrl_error* ctrl_err), (ctrl, ctrl_err)) \
+    X(nlab_ctrl_disable_gpio_pins,                (nlab_ctrl* ctrl, nlab_ctrl_error* ctrl_err), (ctrl, ctrl_err)) \
+    X(nlab_ctrl_set_gpio_pin,                     (nlab_ctrl* ctrl, const_char* id, _Bool on, nlab_ctrl_error* ctrl_err), (ctrl, id, on, ctrl_err)) \
+    X(nlab_ctrl_power_reset,                      (nlab_ctrl* ctrl, nlab_ctrl_error* ctrl_err), (ctrl, ctrl_err)) \
+    X(nlab_ctrl_close,                            (nlab_ctrl* ctrl), (ctrl)) \
+    X(nlab_ctrl_info_list_free,                   (nlab_ctrl_info_list infl), (infl)) \
+    X(nlab_ctrl_info_free,                        (nlab_ctrl_info* inf), (inf)) \
+    X(nlab_ctrl_step_motors_free,                 (nlab_ctrl_step_motors sms), (sms)) \
+    X(nlab_ctrl_step_motor_free,                  (nlab_ctrl_step_motor* sm), (sm)) \
+    X(nlab_ctrl_leds_free,                        (nlab_ctrl_leds leds), (leds)) \
+    X(nlab_ctrl_led_free,                         (nlab_ctrl_led* led), (led)) \
+    X(nlab_ctrl_switches_free,                    (nlab_ctrl_switches sws), (sws)) \
+    X(nlab_ctrl_switch_free,                      (nlab_ctrl_switch* sw), (sw)) \
+    X(nlab_ctrl_gpio_pins_free,                   (nlab_ctrl_gpio_pins gps), (gps)) \
+    X(nlab_ctrl_gpio_pin_free,                    (nlab_ctrl_gpio_pin* gp), (gp))
+
+#define NLAB_CTRL_LAZY_FIELD_(ret, name, params, args, def) ret (*name) params;
+#define NLAB_CTRL_LAZY_VOID_FIELD_(name, params, args) void (*name) params;
+
+/// \brief Internal state shared by all translation units.
+typedef struct {
+    void* handle;
+    char* err;
+    nlab_ctrl_startup_stats stats;
+    NLAB_CTRL_LAZY_FUNCS(NLAB_CTRL_LAZY_FIELD_)
+    NLAB_CTRL_LAZY_VOID_FUNCS(NLAB_CTRL_LAZY_VOID_FIELD_)
+} nlab_ctrl_lazy_state;
+
+/// \brief Internal state. Do not use directly.
+__attribute__((weak)) nlab_ctrl_lazy_state nlab_ctrl_lazy_state_;
+
+/// \brief Guards loading the library. Do not use directly.
+__attribute__((weak)) pthread_once_t nlab_ctrl_lazy_once_ = PTHREAD_ONCE_INIT;
+
+static inline long long int nlab_ctrl_lazy_now_() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long int)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/// \brief Stores "failed to load <path>: <reason>" as the load error.
+static inline void nlab_ctrl_lazy_set_err_(const char* path, const char* reason) {
+    const char* prefix = "failed to load ";
+    if (reason == NULL) {
+        reason = "unknown error";
+    }
+    size_t size = strlen(prefix) + strlen(path) + strlen(reason) + 3;
+    char* msg = (char*)malloc(size);
+    if (msg != NULL) {
+        snprintf(msg, size, "%s%s: %s", prefix, path, reason);
+    }
+    nlab_ctrl_lazy_state_.err = msg;
+}
+
+static inline void nlab_ctrl_lazy_load_() {
+    nlab_ctrl_lazy_state* st = &nlab_ctrl_lazy_state_;
+    const char* path = getenv("NLAB_CTRL_LIB");
+    if (path == NULL) {
+        path = NLAB_CTRL_LAZY_LIB;
+    }
+
+    long long int start = nlab_ctrl_lazy_now_();
+    void* h = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (h == NULL) {
+        nlab_ctrl_lazy_set_err_(path, dlerror());
+        return;
+    }
+    long long int loaded = nlab_ctrl_lazy_now_();
+
+    // The library embeds the Go runtime, which cannot be unloaded again. On a missing symbol
+    // it stays loaded, but no function is bound, so that every call fails like an unloaded library.
+#define NLAB_CTRL_LAZY_BIND_(name) \
+    if (ok) { \
+        *(void**)(&st->name) = dlsym(h, #name); \
+        if (st->name == NULL) { \
+            nlab_ctrl_lazy_set_err_(path, dlerror()); \
+            ok = false; \
+        } \
+    }
+#define NLAB_CTRL_LAZY_BIND_FUNC_(ret, name, params, args, def) NLAB_CTRL_LAZY_BIND_(name)
+#define NLAB_CTRL_LAZY_BIND_VOID_FUNC_(name, params, args) NLAB_CTRL_LAZY_BIND_(name)
+#define NLAB_CTRL_LAZY_UNBIND_(name) st->name = NULL;
+#define NLAB_CTRL_LAZY_UNBIND_FUNC_(ret, name, params, args, def) NLAB_CTRL_LAZY_UNBIND_(name)
+#define NLAB_CTRL_LAZY_UNBIND_VOID_FUNC_(name, params, args) NLAB_CTRL_LAZY_UNBIND_(name)
+    bool ok = true;
+    NLAB_CTRL_LAZY_FUNCS(NLAB_CTRL_LAZY_BIND_FUNC_)
+    NLAB_CTRL_LAZY_VOID_FUNCS(NLAB_CTRL_LAZY_BIND_VOID_FUNC_)
+    if (!ok) {
+        NLAB_CTRL_LAZY_FUNCS(NLAB_CTRL_LAZY_UNBIND_FUNC_)
+        NLAB_CTRL_LAZY_VOID_FUNCS(NLAB_CTRL_LAZY_UNBIND_VOID_FUNC_)
+    }
+#undef NLAB_CTRL_LAZY_UNBIND_VOID_FUNC_
+#undef NLAB_CTRL_LAZY_UNBIND_FUNC_
+#undef NLAB_CTRL_LAZY_UNBIND_
+#undef NLAB_CTRL_LAZY_BIND_VOID_FUNC_
+#undef NLAB_CTRL_LAZY_BIND_FUNC_
+#undef NLAB_CTRL_LAZY_BIND_
+    if (!ok) {
+        return;
+    }
+
+    st->stats.load_time = loaded - start;
+    st->stats.bind_time = nlab_ctrl_lazy_now_() - loaded;
+    st->stats.loaded = true;
+    st->handle = h;
+}
+
+/// \brief Loads the library, unless already done.
+///
+/// \return True, if the library is loaded.
+static inline bool nlab_ctrl_lazy_ensure_() {
+    pthread_once(&nlab_ctrl_lazy_once_, nlab_ctrl_lazy_load_);
+    return nlab_ctrl_lazy_state_.handle != NULL;
+}
+
+//#############//
+//### Error ###//
+//#############//
+
+// The error functions are implemented here to not load the library.
+// They are equivalent to the ones of the library and share its allocator.
+
+static inline nlab_ctrl_error* nlab_ctrl_lazy_error_new() {
+    return (nlab_ctrl_error*)calloc(1, sizeof(nlab_ctrl_error));
+}
+
+static inline void nlab_ctrl_lazy_error_set(nlab_ctrl_error* err, nlab_ctrl_error_code code, char* msg) {
+    free(err->msg);
+    err->code = code;
+    err->msg = msg;
+}
+
+static inline void nlab_ctrl_lazy_error_print(nlab_ctrl_error* err) {
+    if (err->code == NLAB_CTRL_OK) {
+        puts("nlab_ctrl_error: no error");
+    } else if (err->code == NLAB_CTRL_ERR_NOT_FOUND) {
+        printf("nlab_ctrl_error: resource not found\n\t%s\n", err->msg);
+    } else {
+        printf("nlab_ctrl_error: %s\n", err->msg);
+    }
+}
+
+static inline void nlab_ctrl_lazy_error_clear(nlab_ctrl_error* err) {
+    err->code = NLAB_CTRL_OK;
+    free(err->msg);
+    err->msg = NULL;
+}
+
+static inline void nlab_ctrl_lazy_error_free(nlab_ctrl_error* err) {
+    free(err->msg);
+    free(err);
+}
+
+#define nlab_ctrl_error_new   nlab_ctrl_lazy_error_new
+#define nlab_ctrl_error_set   nlab_ctrl_lazy_error_set
+#define nlab_ctrl_error_print nlab_ctrl_lazy_error_print
+#define nlab_ctrl_error_clear nlab_ctrl_lazy_error_clear
+#define nlab_ctrl_error_free  nlab_ctrl_lazy_error_free
+
+//##############//
+//### Loader ###//
+//##############//
+
+/// \brief Sets ctrl_err to the reason the library could not be loaded.
+static inline void nlab_ctrl_lazy_fail_(nlab_ctrl_error* ctrl_err) {
+    const char* err = nlab_ctrl_lazy_state_.err;
+    nlab_ctrl_error_set(ctrl_err, NLAB_CTRL_ERR, strdup(err != NULL ? err : "failed to load " NLAB_CTRL_LAZY_LIB));
+}
+
+/// \brief Loads the library and starts its runtime, unless already done.
+///
+/// Call this at a convenient time to take the startup cost out of the first nlab_ctrl_list() or nlab_ctrl_open().
+///
+/// \param[in,out] ctrl_err   Used to communicate the result of the operation.
+static inline void nlab_ctrl_warm_up(nlab_ctrl_error* ctrl_err) {
+    if (!nlab_ctrl_lazy_ensure_()) {
+        nlab_ctrl_lazy_fail_(ctrl_err);
+    }
+}
+
+/// \brief Returns timing information about loading the library.
+///
+/// All values are zero, as long as the library has not been loaded.
+static inline nlab_ctrl_startup_stats nlab_ctrl_get_startup_stats() {
+    return nlab_ctrl_lazy_state_.stats;
+}
+
+//#################//
+//### Functions ###//
+//#################//
+
+static inline nlab_ctrl_info_list nlab_ctrl_lazy_list(nlab_ctrl_error* ctrl_err) {
+    if (!nlab_ctrl_lazy_ensure_()) {
+        nlab_ctrl_lazy_fail_(ctrl_err);
+        return NULL;
+    }
+    return nlab_ctrl_lazy_state_.nlab_ctrl_list(ctrl_err);
+}
+
+static inline nlab_ctrl* nlab_ctrl_lazy_open(const_char* backend_id, const_char* dev_path, nlab_ctrl_opts opts, nlab_ctrl_error* ctrl_err) {
+    if (!nlab_ctrl_lazy_ensure_()) {
+        nlab_ctrl_lazy_fail_(ctrl_err);
+        return NULL;
+    }
+    return nlab_ctrl_lazy_state_.nlab_ctrl_open(backend_id, dev_path, opts, ctrl_err);
+}
+
+// All other functions operate on values returned by nlab_ctrl_list() or nlab_ctrl_open(),
+// so the library is always loaded when they are called with valid arguments.
+#define NLAB_CTRL_LAZY_WRAP_(ret, name, params, args, def) \
+    static inline ret name##_lazy_ params { \
+        return nlab_ctrl_lazy_state_.name != NULL ? nlab_ctrl_lazy_state_.name args : def; \
+    }
+#define NLAB_CTRL_LAZY_WRAP_VOID_(name, params, args) \
+    static inline void name##_lazy_ params { \
+        if (nlab_ctrl_lazy_state_.name != NULL) { \
+            nlab_ctrl_lazy_state_.name args; \
+        } \
+    }
+NLAB_CTRL_LAZY_FUNCS(NLAB_CTRL_LAZY_WRAP_)
+NLAB_CTRL_LAZY_VOID_FUNCS(NLAB_CTRL_LAZY_WRAP_VOID_)
+#undef NLAB_CTRL_LAZY_WRAP_VOID_
+#undef NLAB_CTRL_LAZY_WRAP_
+
+#define nlab_ctrl_list                             nlab_ctrl_lazy_list
+#define nlab_ctrl_open                             nlab_ctrl_lazy_open
+#define nlab_ctrl_get_step_motors                  nlab_ctrl_get_step_motors_lazy_
+#define nlab_ctrl_get_step_motor                   nlab_ctrl_get_step_motor_lazy_
+#define nlab_ctrl_set_step_motor_rel_pos           nlab_ctrl_set_step_motor_rel_pos_lazy_
+#define nlab_ctrl_set_step_motor_abs_pos           nlab_ctrl_set_step_motor_abs_pos_lazy_
+#define nlab_ctrl_set_status_led                   nlab_ctrl_set_status_led_lazy_
+#define nlab_ctrl_set_status_led_blinking_duration nlab_ctrl_set_status_led_blinking_duration_lazy_
+#define nlab_ctrl_get_leds                         nlab_ctrl_get_leds_lazy_
+#define nlab_ctrl_get_led                          nlab_ctrl_get_led_lazy_
+#define nlab_ctrl_set_led                          nlab_ctrl_set_led_lazy_
+#define nlab_ctrl_set_led_strobe                   nlab_ctrl_set_led_strobe_lazy_
+#define nlab_ctrl_set_led_brightness               nlab_ctrl_set_led_brightness_lazy_
+#define nlab_ctrl_set_led_strobe_delay             nlab_ctrl_set_led_strobe_delay_lazy_
+#define nlab_ctrl_get_switches                     nlab_ctrl_get_switches_lazy_
+#define nlab_ctrl_get_switch                       nlab_ctrl_get_switch_lazy_
+#define nlab_ctrl_set_switch                       nlab_ctrl_set_switch_lazy_
+#define nlab_ctrl_enable_gpio_pins                 nlab_ctrl_enable_gpio_pins_lazy_
+#define nlab_ctrl_disable_gpio_pins                nlab_ctrl_disable_gpio_pins_lazy_
+#define nlab_ctrl_gpio_pins_enabled                nlab_ctrl_gpio_pins_enabled_lazy_
+#define nlab_ctrl_get_gpio_pins                    nlab_ctrl_get_gpio_pins_lazy_
+#define nlab_ctrl_get_gpio_pin                     nlab_ctrl_get_gpio_pin_lazy_
+#define nlab_ctrl_set_gpio_pin                     nlab_ctrl_set_gpio_pin_lazy_
+#define nlab_ctrl_temperature                      nlab_ctrl_temperature_lazy_
+#define nlab_ctrl_power_reset                      nlab_ctrl_power_reset_lazy_
+#define nlab_ctrl_close                            nlab_ctrl_close_lazy_
+#define nlab_ctrl_info_list_size                   nlab_ctrl_info_list_size_lazy_
+#define nlab_ctrl_info_list_at_index               nlab_ctrl_info_list_at_index_lazy_
+#define nlab_ctrl_info_list_free                   nlab_ctrl_info_list_free_lazy_
+#define nlab_ctrl_info_free                        nlab_ctrl_info_free_lazy_
+#define nlab_ctrl_step_motors_size                 nlab_ctrl_step_motors_size_lazy_
+#define nlab_ctrl_step_motors_at_index             nlab_ctrl_step_motors_at_index_lazy_
+#define nlab_ctrl_step_motors_free                 nlab_ctrl_step_motors_free_lazy_
+#define nlab_ctrl_step_motor_free                  nlab_ctrl_step_motor_free_lazy_
+#define nlab_ctrl_leds_size                        nlab_ctrl_leds_size_lazy_
+#define nlab_ctrl_leds_at_index                    nlab_ctrl_leds_at_index_lazy_
+#define nlab_ctrl_leds_free                        nlab_ctrl_leds_free_lazy_
+#define nlab_ctrl_led_free                         nlab_ctrl_led_free_lazy_
+#define nlab_ctrl_switches_size                    nlab_ctrl_switches_size_lazy_
+#define nlab_ctrl_switches_at_index                nlab_ctrl_switches_at_index_lazy_
+#define nlab_ctrl_switches_free                    nlab_ctrl_switches_free_lazy_
+#define nlab_ctrl_switch_free                      nlab_ctrl_switch_free_lazy_
+#define nlab_ctrl_gpio_pins_size                   nlab_ctrl_gpio_pins_size_lazy_
+#define nlab_ctrl_gpio_pins_at_index               nlab_ctrl_gpio_pins_at_index_lazy_
+#define nlab_ctrl_gpio_pins_free                   nlab_ctrl_gpio_pins_free_lazy_
+#define nlab_ctrl_gpio_pin_free                    nlab_ctrl_gpio_pin_free_lazy_
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,335 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+// Stress test of the ownership functions of the C API against the dummy backend.
+//
+// Runs open/close churn, list and struct alloc/free, error set/clear and concurrent calls,
+// and reports per phase the time and the heap allocations per call, and the growth of the live heap and the RSS.
+// Exits with 1, if the live heap of a phase grew by more than the leak threshold.
+//
+// Build it with -fsanitize=address or -fsanitize=thread to check for memory and threading errors,
+// the allocation counters are disabled then.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <malloc.h>
+
+#include <libnlab-ctrl.h>
+
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define COUNT_ALLOCS 0
+#else
+#define COUNT_ALLOCS 1
+#endif
+
+//##################//
+//### Allocation ###//
+//##################//
+
+static uint64_t allocs = 0;
+static int64_t  live   = 0;
+
+#if COUNT_ALLOCS
+// Interposes the allocator of libc for the whole process, including the controller library.
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* p, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void  __libc_free(void* p);
+
+static void* counted(void* p) {
+    if (p != NULL) {
+        __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&live, malloc_usable_size(p), __ATOMIC_RELAXED);
+    }
+    return p;
+}
+
+void* malloc(size_t size) {
+    return counted(__libc_malloc(size));
+}
+
+void* calloc(size_t n, size_t size) {
+    return counted(__libc_calloc(n, size));
+}
+
+void* realloc(void* p, size_t size) {
+    size_t old = p != NULL ? malloc_usable_size(p) : 0;
+    void* q = __libc_realloc(p, size);
+    if (q != NULL) {
+        __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&live, (int64_t)malloc_usable_size(q) - (int64_t)old, __ATOMIC_RELAXED);
+    }
+    return q;
+}
+
+void* memalign(size_t alignment, size_t size) {
+    return counted(__libc_memalign(alignment, size));
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    return counted(__libc_memalign(alignment, size));
+}
+
+int posix_memalign(void** p, size_t alignment, size_t size) {
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0) {
+        return EINVAL;
+    }
+    void* q = counted(__libc_memalign(alignment, size));
+    if (q == NULL) {
+        return ENOMEM;
+    }
+    *p = q;
+    return 0;
+}
+
+void free(void* p) {
+    if (p != NULL) {
+        __atomic_sub_fetch(&live, malloc_usable_size(p), __ATOMIC_RELAXED);
+    }
+    __libc_free(p);
+}
+#endif
+
+//###############//
+//### Helpers ###//
+//###############//
+
+typedef struct {
+    const char* name;
+    uint64_t    calls;
+    double      start_s;
+    uint64_t    start_allocs;
+    int64_t     start_live;
+    long        start_rss;
+} phase;
+
+static nlab_ctrl* ctrl;
+static int        iterations = 1000000;
+static int        threads    = 4;
+static long       leak_limit = 64 * 1024;
+static int        leaked     = 0;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long rss_bytes(void) {
+    long pages = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void begin(phase* p, const char* name) {
+    p->name = name;
+    p->calls = 0;
+    p->start_allocs = __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+    p->start_live = __atomic_load_n(&live, __ATOMIC_RELAXED);
+    p->start_rss = rss_bytes();
+    p->start_s = now_s();
+}
+
+static void end(phase* p) {
+    double d = now_s() - p->start_s;
+    uint64_t a = __atomic_load_n(&allocs, __ATOMIC_RELAXED) - p->start_allocs;
+    int64_t l = __atomic_load_n(&live, __ATOMIC_RELAXED) - p->start_live;
+    long r = rss_bytes() - p->start_rss;
+
+    printf("%-12s %10llu calls %10.0f ns/call", p->name, (unsigned long long)p->calls, d * 1e9 / (p->calls ? p->calls : 1));
+    if (COUNT_ALLOCS) {
+        printf(" %8.2f allocs/call %+10lld live bytes", (double)a / (p->calls ? p->calls : 1), (long long)l);
+    }
+    printf(" %+10ld rss bytes\n", r);
+
+    if (COUNT_ALLOCS && l > leak_limit) {
+        printf("%-12s LEAK: live heap grew by %lld bytes\n", p->name, (long long)l);
+        leaked = 1;
+    }
+}
+
+static void check(nlab_ctrl_error* err, const char* what) {
+    if (err->code != NLAB_CTRL_OK) {
+        printf("%s: ", what);
+        nlab_ctrl_error_print(err);
+        exit(2);
+    }
+}
+
+//##############//
+//### Phases ###//
+//##############//
+
+static void open_close(phase* p, int n) {
+    for (int i = 0; i < n; ++i) {
+        nlab_ctrl_error* err = nlab_ctrl_error_new();
+        nlab_ctrl_opts opts = {0};
+        nlab_ctrl* c = nlab_ctrl_open("dummy", "", opts, err);
+        check(err, "open");
+        nlab_ctrl_close(c);
+        nlab_ctrl_error_free(err);
+        p->calls += 2;
+    }
+}
+
+static void lists(phase* p, int n) {
+    nlab_ctrl_error err = {NLAB_CTRL_OK, NULL};
+    for (int i = 0; i < n; ++i) {
+        nlab_ctrl_step_motors sms = nlab_ctrl_get_step_motors(ctrl, &err);
+        check(&err, "get step motors");
+        for (int j = 0, size = nlab_ctrl_step_motors_size(sms); j < size; ++j) {
+            nlab_ctrl_step_motors_at_index(sms, j);
+        }
+        nlab_ctrl_step_motors_free(sms);
+
+        nlab_ctrl_leds leds = nlab_ctrl_get_leds(ctrl, &err);
+        check(&err, "get leds");
+        for (int j = 0, size = nlab_ctrl_leds_size(leds); j < size; ++j) {
+            nlab_ctrl_leds_at_index(leds, j);
+        }
+        nlab_ctrl_leds_free(leds);
+
+        nlab_ctrl_switches sws = nlab_ctrl_get_switches(ctrl, &err);
+        check(&err, "get switches");
+        for (int j = 0, size = nlab_ctrl_switches_size(sws); j < size; ++j) {
+            nlab_ctrl_switches_at_index(sws, j);
+        }
+        nlab_ctrl_switches_free(sws);
+
+        nlab_ctrl_gpio_pins gps = nlab_ctrl_get_gpio_pins(ctrl, &err);
+        check(&err, "get gpio pins");
+        for (int j = 0, size = nlab_ctrl_gpio_pins_size(gps); j < size; ++j) {
+            nlab_ctrl_gpio_pins_at_index(gps, j);
+        }
+        nlab_ctrl_gpio_pins_free(gps);
+
+        p->calls += 4;
+    }
+}
+
+static void items(phase* p, int n) {
+    nlab_ctrl_error err = {NLAB_CTRL_OK, NULL};
+    for (int i = 0; i < n; ++i) {
+        nlab_ctrl_step_motor_free(nlab_ctrl_get_step_motor(ctrl, "step1", &err));
+        check(&err, "get step motor");
+        nlab_ctrl_led_free(nlab_ctrl_get_led(ctrl, "led1", &err));
+        check(&err, "get led");
+        nlab_ctrl_gpio_pin_free(nlab_ctrl_get_gpio_pin(ctrl, "gpio-1", &err));
+        check(&err, "get gpio pin");
+        p->calls += 3;
+    }
+}
+
+static void errors(phase* p, int n) {
+    nlab_ctrl_error* err = nlab_ctrl_error_new();
+    for (int i = 0; i < n; ++i) {
+        nlab_ctrl_led* led = nlab_ctrl_get_led(ctrl, "missing", err);
+        if (led != NULL || err->code == NLAB_CTRL_OK) {
+            printf("errors: expected a failure\n");
+            exit(2);
+        }
+        // nlab_ctrl_error_clear() does not reset msg, so it is only called once per failure.
+        nlab_ctrl_error_clear(err);
+        err->msg = NULL;
+        p->calls++;
+    }
+    nlab_ctrl_error_free(err);
+}
+
+static void* worker(void* arg) {
+    int n = *(int*)arg;
+    nlab_ctrl_error err = {NLAB_CTRL_OK, NULL};
+    for (int i = 0; i < n; ++i) {
+        nlab_ctrl_set_led_brightness(ctrl, "led1", i % 100, &err);
+        check(&err, "set led brightness");
+        nlab_ctrl_set_gpio_pin(ctrl, "gpio-3", i % 2, &err);
+        check(&err, "set gpio pin");
+        nlab_ctrl_leds_free(nlab_ctrl_get_leds(ctrl, &err));
+        check(&err, "get leds");
+        nlab_ctrl_temperature(ctrl, &err);
+        check(&err, "temperature");
+    }
+    return NULL;
+}
+
+static void concurrent(phase* p, int n) {
+    pthread_t ts[threads];
+    int per = n / threads;
+    for (int i = 0; i < threads; ++i) {
+        pthread_create(&ts[i], NULL, worker, &per);
+    }
+    for (int i = 0; i < threads; ++i) {
+        pthread_join(ts[i], NULL);
+    }
+    p->calls += (uint64_t)per * threads * 4;
+}
+
+// Runs a phase once to warm up the caches of the library and once measured.
+static void run(const char* name, void (*fn)(phase*, int), int n) {
+    phase p;
+    begin(&p, name);
+    fn(&p, n / 10 > 0 ? n / 10 : 1);
+    begin(&p, name);
+    fn(&p, n);
+    end(&p);
+}
+
+//############//
+//### Main ###//
+//############//
+
+int main(int argc, char** argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:l:")) != -1) {
+        switch (opt) {
+        case 'n': iterations = atoi(optarg); break;
+        case 't': threads = atoi(optarg); break;
+        case 'l': leak_limit = atol(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-n iterations] [-t threads] [-l leak threshold in bytes]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (iterations < 1 || threads < 1) {
+        fprintf(stderr, "iterations and threads must be positive\n");
+        return 2;
+    }
+    if (!COUNT_ALLOCS) {
+        printf("built with a sanitizer, allocation counters are disabled\n");
+    }
+
+    nlab_ctrl_error err = {NLAB_CTRL_OK, NULL};
+    nlab_ctrl_opts opts = {0};
+    ctrl = nlab_ctrl_open("dummy", "", opts, &err);
+    check(&err, "open");
+    nlab_ctrl_enable_gpio_pins(ctrl, &err);
+    check(&err, "enable gpio pins");
+
+    run("open/close", open_close, iterations / 100 > 0 ? iterations / 100 : 1);
+    run("lists", lists, iterations);
+    run("items", items, iterations);
+    run("errors", errors, iterations);
+    run("concurrent", concurrent, iterations);
+
+    nlab_ctrl_close(ctrl);
+    return leaked;
+}
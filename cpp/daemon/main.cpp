@@ -0,0 +1,52 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+#include <string>
+#include <iostream>
+#include <csignal>
+
+#include <libnlab-ctrl-ipc.hpp>
+
+using namespace std;
+using namespace nlab::ctrl;
+
+static ipc::Server* server = nullptr;
+
+void handleSignal(int) {
+    if (server != nullptr) {
+        server->stop();
+    }
+}
+
+int main(int argc, char* argv[]) {
+    string socketPath = ipc::DefaultSocketPath;
+    if (argc > 2 || (argc == 2 && string(argv[1]) == "-h")) {
+        cerr << "usage: " << argv[0] << " [socket path]" << endl;
+        return 1;
+    } else if (argc == 2) {
+        socketPath = argv[1];
+    }
+
+    try {
+        ipc::Server s(socketPath);
+        server = &s;
+
+        struct sigaction sa = {};
+        sa.sa_handler = handleSignal;
+        sigaction(SIGINT, &sa, nullptr);
+        sigaction(SIGTERM, &sa, nullptr);
+
+        cout << "serving controllers on " << socketPath << endl;
+        s.run();
+        server = nullptr;
+    } catch (Exception& e) {
+        cerr << "exception! code: " << to_string(e.code()) << ", message: " << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
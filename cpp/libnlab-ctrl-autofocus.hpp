@@ -0,0 +1,292 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the Autofocus engine, that searches the sharpest position of a step motor.
+#ifndef NLAB_CTRL_LIB_AUTOFOCUS_HPP
+#define NLAB_CTRL_LIB_AUTOFOCUS_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <future>
+#include <chrono>
+#include <thread>
+#include <cmath>
+#include <algorithm>
+
+#include <libnlab-ctrl.hpp>
+
+namespace nlab::ctrl {
+
+/// \brief The search strategy of the Autofocus.
+enum AutofocusStrategy {
+    CoarseToFine  = 0, ///< Sweeps the range with a coarse step and refines around the best position. Robust against local maxima.
+    GoldenSection = 1  ///< Narrows the range by the golden ratio. Needs the fewest evaluations, but requires a single maximum.
+};
+
+/// \brief Options for the Autofocus.
+///
+/// For every member that is not set a sensible default value is used. This means that an empty struct represents default options.
+struct AutofocusOpts {
+    /// \brief The search strategy. Defaults to AutofocusStrategy::CoarseToFine.
+    AutofocusStrategy strategy = CoarseToFine;
+
+    /// \brief Lower bound of the search range. Defaults to StepMotor::minStep, if both bounds are equal.
+    int minStep = 0;
+
+    /// \brief Upper bound of the search range. Defaults to StepMotor::maxStep, if both bounds are equal.
+    int maxStep = 0;
+
+    /// \brief Step size of the first sweep of AutofocusStrategy::CoarseToFine. Defaults to 1/16 of the range.
+    int coarseStep = 0;
+
+    /// \brief The search stops, once the step size or range falls below this value. Defaults to 1.
+    int fineStep = 1;
+
+    /// \brief Divisor applied to the step size on every refinement of AutofocusStrategy::CoarseToFine. Defaults to 4.
+    int refineFactor = 4;
+
+    /// \brief Backlash of the motor's gear in steps. Defaults to 0.
+    ///
+    /// Every position is approached moving upwards. Downward moves overshoot by this amount first,
+    /// so that the gear play is always taken up in the same direction.
+    int backlash = 0;
+
+    /// \brief Time the motor needs to come to rest after a move, before a frame is captured. Defaults to 0.
+    std::chrono::milliseconds settle = std::chrono::milliseconds(0);
+};
+
+/// \brief The result of an Autofocus run.
+struct AutofocusResult {
+    int                      step;        ///< The sharpest position found. The motor is left at this position.
+    double                   sharpness;   ///< The sharpness at step.
+    int                      evaluations; ///< Number of positions evaluated.
+    int                      moves;       ///< Number of motor commands sent.
+    std::chrono::nanoseconds duration;    ///< Duration of the run.
+};
+
+/// \brief Drives a StepMotor to the position with the highest sharpness.
+///
+/// The sharpness is provided by the caller, typically computed from a camera frame.
+/// Instead of sweeping the whole range, the search evaluates only a small fraction of all positions.
+class Autofocus {
+public:
+    /// \brief Measures the sharpness at the given position.
+    ///
+    /// Called once the motor came to rest at step. Higher values mean sharper.
+    typedef std::function<double(int step)> SharpnessFunc;
+
+    /// \brief Captures a frame at the given position and returns a function that computes its sharpness.
+    ///
+    /// The returned function is run on another thread while the motor already moves to the next position.
+    typedef std::function<std::function<double()>(int step)> CaptureFunc;
+
+    /// \brief Creates an Autofocus for a step motor.
+    ///
+    /// \param[in]  ctrl     The controller.
+    /// \param[in]  motorID  The id of the step motor to drive.
+    /// \param[in]  opts     Optional parameters of the search.
+    Autofocus(Controller::Ptr ctrl, const std::string& motorID, const AutofocusOpts& opts = AutofocusOpts())
+        : ctrl_(ctrl), motorID_(motorID), opts_(opts) {}
+
+    /// \brief Runs the search, evaluating every position before the motor moves on.
+    ///
+    /// \param[in]  sharpness  Measures the sharpness at the current position.
+    ///
+    /// \return The AutofocusResult.
+    /// \throws Exception
+    AutofocusResult run(SharpnessFunc sharpness) {
+        return search([&](int step) {
+            double v = sharpness(step);
+            return [v] { return v; };
+        });
+    }
+
+    /// \brief Runs the search, moving the motor while the sharpness of the last position is computed.
+    ///
+    /// Only sweeps of AutofocusStrategy::CoarseToFine are pipelined,
+    /// as every position of AutofocusStrategy::GoldenSection depends on the previous result.
+    ///
+    /// \param[in]  capture  Captures a frame at the current position.
+    ///
+    /// \return The AutofocusResult.
+    /// \throws Exception
+    AutofocusResult runPipelined(CaptureFunc capture) {
+        return search(capture);
+    }
+
+private:
+    AutofocusResult search(CaptureFunc capture) {
+        auto start = std::chrono::steady_clock::now();
+        evals_.clear();
+        moves_ = 0;
+
+        StepMotor sm = ctrl_->getStepMotor(motorID_);
+        pos_ = sm.step;
+        lo_ = opts_.minStep != opts_.maxStep ? opts_.minStep : sm.minStep;
+        hi_ = opts_.minStep != opts_.maxStep ? opts_.maxStep : sm.maxStep;
+        lo_ = std::max(lo_, sm.minStep);
+        hi_ = std::min(hi_, sm.maxStep);
+        motorMin_ = sm.minStep;
+        if (lo_ > hi_) {
+            throw Exception(Exception::Generic, "autofocus: empty search range");
+        }
+
+        if (opts_.strategy == GoldenSection) {
+            goldenSection(capture);
+        } else {
+            coarseToFine(capture);
+        }
+
+        auto best = std::max_element(evals_.begin(), evals_.end(),
+            [](const auto& a, const auto& b) { return a.second < b.second; });
+        moveTo(best->first);
+
+        AutofocusResult r;
+        r.step        = best->first;
+        r.sharpness   = best->second;
+        r.evaluations = static_cast<int>(evals_.size());
+        r.moves       = moves_;
+        r.duration    = std::chrono::steady_clock::now() - start;
+        return r;
+    }
+
+    void coarseToFine(CaptureFunc& capture) {
+        int fine = std::max(1, opts_.fineStep);
+        int step = opts_.coarseStep > 0 ? opts_.coarseStep : std::max(fine, (hi_ - lo_) / 16);
+        int lo = lo_;
+        int hi = hi_;
+
+        for (;;) {
+            std::vector<int> points;
+            for (int p = lo; p < hi; p += step) {
+                points.push_back(p);
+            }
+            points.push_back(hi);
+            sweep(points, capture);
+
+            if (step <= fine) {
+                return;
+            }
+
+            // Refine around the best position found so far.
+            int best = bestIn(lo, hi);
+            lo = std::max(lo_, best - step);
+            hi = std::min(hi_, best + step);
+            step = std::max(fine, step / std::max(2, opts_.refineFactor));
+        }
+    }
+
+    void goldenSection(CaptureFunc& capture) {
+        const double invPhi = (std::sqrt(5.0) - 1) / 2;
+        int fine = std::max(1, opts_.fineStep);
+        double a = lo_;
+        double b = hi_;
+        int c = static_cast<int>(std::lround(b - (b - a) * invPhi));
+        int d = static_cast<int>(std::lround(a + (b - a) * invPhi));
+        double fc = evaluate(c, capture);
+        double fd = evaluate(d, capture);
+
+        while (b - a > fine && c < d) {
+            if (fc >= fd) {
+                b = d;
+                d = c;
+                fd = fc;
+                c = static_cast<int>(std::lround(b - (b - a) * invPhi));
+                fc = evaluate(c, capture);
+            } else {
+                a = c;
+                c = d;
+                fc = fd;
+                d = static_cast<int>(std::lround(a + (b - a) * invPhi));
+                fd = evaluate(d, capture);
+            }
+        }
+    }
+
+    // Evaluates the positions in ascending order. The motor already moves to the
+    // next position while the sharpness of the previous one is computed.
+    void sweep(const std::vector<int>& points, CaptureFunc& capture) {
+        std::future<double> pending;
+        int pendingStep = 0;
+        for (int p : points) {
+            if (evals_.count(p) > 0) {
+                continue;
+            }
+            moveTo(p);
+            auto eval = capture(p);
+            if (pending.valid()) {
+                evals_[pendingStep] = pending.get();
+            }
+            pending = std::async(std::launch::async, eval);
+            pendingStep = p;
+        }
+        if (pending.valid()) {
+            evals_[pendingStep] = pending.get();
+        }
+    }
+
+    double evaluate(int p, CaptureFunc& capture) {
+        auto it = evals_.find(p);
+        if (it != evals_.end()) {
+            return it->second;
+        }
+        moveTo(p);
+        return evals_[p] = capture(p)();
+    }
+
+    int bestIn(int lo, int hi) const {
+        int best = lo;
+        double v = -HUGE_VAL;
+        for (auto it = evals_.lower_bound(lo); it != evals_.end() && it->first <= hi; ++it) {
+            if (it->second > v) {
+                v = it->second;
+                best = it->first;
+            }
+        }
+        return best;
+    }
+
+    void moveTo(int target) {
+        if (target == pos_) {
+            return;
+        }
+        if (target < pos_ && opts_.backlash > 0) {
+            int under = std::max(motorMin_, target - opts_.backlash);
+            if (under < target) {
+                move(under);
+            }
+        }
+        move(target);
+        if (opts_.settle.count() > 0) {
+            std::this_thread::sleep_for(opts_.settle);
+        }
+    }
+
+    void move(int target) {
+        ctrl_->setStepMotorRelPos(motorID_, target - pos_);
+        pos_ = target;
+        moves_++;
+    }
+
+    Controller::Ptr     ctrl_;
+    const std::string   motorID_;
+    const AutofocusOpts opts_;
+
+    std::map<int, double> evals_;
+    int                   pos_      = 0;
+    int                   lo_       = 0;
+    int                   hi_       = 0;
+    int                   motorMin_ = 0;
+    int                   moves_    = 0;
+};
+
+}
+
+#endif
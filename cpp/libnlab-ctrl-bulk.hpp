@@ -0,0 +1,134 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains bulk conversions of C resource lists to their C++ types.
+///
+/// The conversions query the size of a list once and then read its elements directly,
+/// instead of calling the bounds checked *_at_index() accessor of the C API per element.
+/// All result vectors are reserved upfront. \n
+/// GPIOPinStates additionally packs the states of a gpio pin list into bitmasks.
+///
+/// The lists are not freed, this remains the responsibility of the caller.
+#ifndef NLAB_CTRL_LIB_BULK_HPP
+#define NLAB_CTRL_LIB_BULK_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <libnlab-ctrl.hpp>
+
+namespace nlab::ctrl {
+
+/// \brief Converts a C list of step motors.
+inline std::vector<StepMotor> stepMotorsFromC(nlab_ctrl_step_motors sms) {
+    const int n = sms ? nlab_ctrl_step_motors_size(sms) : 0;
+    std::vector<StepMotor> v;
+    v.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        const nlab_ctrl_step_motor* sm = sms[i];
+        v.push_back(StepMotor{std::string(sm->id), std::string(sm->name), sm->step, sm->min_step, sm->max_step});
+    }
+    return v;
+}
+
+/// \brief Converts a C list of leds.
+inline std::vector<LED> ledsFromC(nlab_ctrl_leds leds) {
+    const int n = leds ? nlab_ctrl_leds_size(leds) : 0;
+    std::vector<LED> v;
+    v.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        const nlab_ctrl_led* led = leds[i];
+        v.push_back(LED{std::string(led->id), std::string(led->name), led->on, led->brightness, led->strobe_on, led->strobe_delay});
+    }
+    return v;
+}
+
+/// \brief Converts a C list of switches.
+inline std::vector<Switch> switchesFromC(nlab_ctrl_switches sws) {
+    const int n = sws ? nlab_ctrl_switches_size(sws) : 0;
+    std::vector<Switch> v;
+    v.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        const nlab_ctrl_switch* sw = sws[i];
+        v.push_back(Switch{std::string(sw->id), std::string(sw->name), sw->on});
+    }
+    return v;
+}
+
+/// \brief Converts a C list of gpio pins.
+inline std::vector<GPIOPin> gpioPinsFromC(nlab_ctrl_gpio_pins gps) {
+    const int n = gps ? nlab_ctrl_gpio_pins_size(gps) : 0;
+    std::vector<GPIOPin> v;
+    v.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        const nlab_ctrl_gpio_pin* gp = gps[i];
+        v.push_back(GPIOPin{std::string(gp->id), std::string(gp->name), static_cast<GPIOPinDirection>(gp->direction), gp->on});
+    }
+    return v;
+}
+
+/// \brief The states of a list of gpio pins, packed into bitmasks.
+///
+/// Pin i is represented by bit i % 64 of word i / 64 of each mask.
+struct GPIOPinStates {
+    std::vector<std::string> ids;    ///< The ids of the pins, in list order.
+    std::vector<uint64_t>    on;     ///< The on state of the pins.
+    std::vector<uint64_t>    input;  ///< Set for pins with direction IN or IO.
+    std::vector<uint64_t>    output; ///< Set for pins with direction OUT or IO.
+
+    /// \brief Returns the number of pins.
+    size_t size() const noexcept { return ids.size(); }
+
+    /// \brief Returns the on state of pin i.
+    bool isOn(size_t i) const noexcept { return (on[i >> 6] >> (i & 63)) & 1; }
+
+    /// \brief Packs a list of GPIOPins.
+    static GPIOPinStates from(const std::vector<GPIOPin>& gps) {
+        GPIOPinStates s;
+        s.resize(gps.size());
+        for (size_t i = 0; i < gps.size(); ++i) {
+            s.ids.push_back(gps[i].id);
+            s.set(i, gps[i].direction, gps[i].on);
+        }
+        return s;
+    }
+
+    /// \brief Packs a C list of gpio pins.
+    static GPIOPinStates fromC(nlab_ctrl_gpio_pins gps) {
+        const int n = gps ? nlab_ctrl_gpio_pins_size(gps) : 0;
+        GPIOPinStates s;
+        s.resize(n);
+        for (int i = 0; i < n; ++i) {
+            const nlab_ctrl_gpio_pin* gp = gps[i];
+            s.ids.emplace_back(gp->id);
+            s.set(i, static_cast<GPIOPinDirection>(gp->direction), gp->on);
+        }
+        return s;
+    }
+
+private:
+    void resize(size_t n) {
+        const size_t words = (n + 63) / 64;
+        ids.reserve(n);
+        on.assign(words, 0);
+        input.assign(words, 0);
+        output.assign(words, 0);
+    }
+
+    void set(size_t i, GPIOPinDirection dir, bool v) noexcept {
+        const uint64_t bit = uint64_t(1) << (i & 63);
+        on[i >> 6]     |= v ? bit : 0;
+        input[i >> 6]  |= dir != OUT ? bit : 0;
+        output[i >> 6] |= dir != IN ? bit : 0;
+    }
+};
+
+}
+
+#endif
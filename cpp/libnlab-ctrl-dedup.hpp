@@ -0,0 +1,307 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the DedupController, that suppresses writes of values the controller already has.
+///
+/// Every setter sends a command over the link and the controller persists the new state to disk,
+/// even if the value did not change. The DedupController remembers the last confirmed value of every output,
+/// learned from successful setters and from getters, and drops writes that would not change it.
+/// Every setter has an overload with a force flag, that sends the command regardless.
+#ifndef NLAB_CTRL_LIB_DEDUP_HPP
+#define NLAB_CTRL_LIB_DEDUP_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+#include <type_traits>
+
+#include <libnlab-ctrl.hpp>
+#include <libnlab-ctrl-forward.hpp>
+
+namespace nlab::ctrl {
+
+/// \brief Statistics of a DedupController.
+struct DedupStats {
+    uint64_t sent;       ///< Number of writes sent to the controller.
+    uint64_t suppressed; ///< Number of writes dropped, because the value was already set.
+};
+
+/// \brief A Controller that drops redundant writes.
+///
+/// The known values are invalidated by failed writes, relative motor moves, powerReset()
+/// and, for gpio pins, enableGPIOPins() and disableGPIOPins(). If other processes change the controller,
+/// call invalidate() or a getter to learn the current values. \n
+/// Writes to gpio pins are only dropped for pins that a getter reported as outputs.
+class DedupController : public ForwardingController {
+public:
+    /// \brief Opens a controller and wraps it.
+    ///
+    /// \throws Exception
+    static std::shared_ptr<DedupController> open(const std::string& backendID, const std::string& devPath, const ControllerOpts& opts) {
+        return std::make_shared<DedupController>(Controller::open(backendID, devPath, opts));
+    }
+
+    /// \brief Wraps the controller inner.
+    explicit DedupController(Controller::Ptr inner) : ForwardingController(inner) {}
+
+    /// \brief Forgets all known values, so that the next write of every output is sent.
+    void invalidate() {
+        std::lock_guard<std::mutex> lock(mx_);
+        forget();
+    }
+
+    /// \brief Returns the statistics.
+    DedupStats stats() {
+        std::lock_guard<std::mutex> lock(mx_);
+        return stats_;
+    }
+
+    //###############//
+    //### Getters ###//
+    //###############//
+
+    std::vector<StepMotor> getStepMotors() override {
+        return read([&] { return inner_->getStepMotors(); }, [&](const std::vector<StepMotor>& sms) {
+            for (const StepMotor& sm : sms) {
+                learn(sm);
+            }
+        });
+    }
+    StepMotor getStepMotor(const std::string& id) override {
+        return read([&] { return inner_->getStepMotor(id); }, [&](const StepMotor& sm) { learn(sm); });
+    }
+    std::vector<LED> getLEDs() override {
+        return read([&] { return inner_->getLEDs(); }, [&](const std::vector<LED>& leds) {
+            for (const LED& l : leds) {
+                learn(l);
+            }
+        });
+    }
+    LED getLED(const std::string& id) override {
+        return read([&] { return inner_->getLED(id); }, [&](const LED& l) { learn(l); });
+    }
+    std::vector<Switch> getSwitches() override {
+        return read([&] { return inner_->getSwitches(); }, [&](const std::vector<Switch>& sws) {
+            for (const Switch& sw : sws) {
+                switches_[sw.id] = sw.on;
+            }
+        });
+    }
+    Switch getSwitch(const std::string& id) override {
+        return read([&] { return inner_->getSwitch(id); }, [&](const Switch& sw) { switches_[sw.id] = sw.on; });
+    }
+    std::vector<GPIOPin> getGPIOPins() override {
+        return read([&] { return inner_->getGPIOPins(); }, [&](const std::vector<GPIOPin>& gps) {
+            for (const GPIOPin& gp : gps) {
+                learn(gp);
+            }
+        });
+    }
+    GPIOPin getGPIOPin(const std::string& id) override {
+        return read([&] { return inner_->getGPIOPin(id); }, [&](const GPIOPin& gp) { learn(gp); });
+    }
+
+    //###############//
+    //### Setters ###//
+    //###############//
+
+    void setStepMotorRelPos(const std::string& id, int step) override { setStepMotorRelPos(id, step, false); }
+    /// \brief Moves the step motor relatively, a move by 0 steps is dropped unless force is set.
+    void setStepMotorRelPos(const std::string& id, int step, bool force) {
+        std::lock_guard<std::mutex> lock(mx_);
+        if (step == 0 && !force) {
+            stats_.suppressed++;
+            return;
+        }
+        // The controller clamps moves to the range of the motor, so the new position is unknown.
+        motors_.erase(id);
+        stats_.sent++;
+        gen_++;
+        inner_->setStepMotorRelPos(id, step);
+    }
+
+    void setStepMotorAbsPos(const std::string& id, int step) override { setStepMotorAbsPos(id, step, false); }
+    /// \brief Moves the step motor absolutely, unless it is known to be at step or force is set.
+    void setStepMotorAbsPos(const std::string& id, int step, bool force) {
+        write(motors_, id, step, force, [&] { inner_->setStepMotorAbsPos(id, step); });
+    }
+
+    void setStatusLED(StatusLEDState state) override { setStatusLED(state, false); }
+    /// \brief Sets the status led, unless it is known to be in state or force is set.
+    void setStatusLED(StatusLEDState state, bool force) {
+        write(status_, "state", static_cast<long long int>(state), force, [&] { inner_->setStatusLED(state); });
+    }
+
+    void setStatusLEDBlinkingDuration(long long int duration) override { setStatusLEDBlinkingDuration(duration, false); }
+    /// \brief Sets the blinking duration of the status led, unless it is known or force is set.
+    void setStatusLEDBlinkingDuration(long long int duration, bool force) {
+        write(status_, "blinking", duration, force, [&] { inner_->setStatusLEDBlinkingDuration(duration); });
+    }
+
+    void setLED(const std::string& id, bool on) override { setLED(id, on, false); }
+    /// \brief Switches the led, unless it is known to be in that state or force is set.
+    void setLED(const std::string& id, bool on, bool force) {
+        write(ledOn_, id, on, force, [&] { inner_->setLED(id, on); });
+    }
+
+    void setLEDStrobe(const std::string& id, bool on) override { setLEDStrobe(id, on, false); }
+    /// \brief Switches the strobe of the led, unless it is known to be in that state or force is set.
+    void setLEDStrobe(const std::string& id, bool on, bool force) {
+        write(ledStrobe_, id, on, force, [&] { inner_->setLEDStrobe(id, on); });
+    }
+
+    void setLEDBrightness(const std::string& id, int brightness) override { setLEDBrightness(id, brightness, false); }
+    /// \brief Sets the brightness of the led, unless it is known or force is set.
+    void setLEDBrightness(const std::string& id, int brightness, bool force) {
+        write(ledBrightness_, id, brightness, force, [&] { inner_->setLEDBrightness(id, brightness); });
+    }
+
+    void setLEDStrobeDelay(const std::string& id, int delay) override { setLEDStrobeDelay(id, delay, false); }
+    /// \brief Sets the strobe delay of the led, unless it is known or force is set.
+    void setLEDStrobeDelay(const std::string& id, int delay, bool force) {
+        write(ledStrobeDelay_, id, delay, force, [&] { inner_->setLEDStrobeDelay(id, delay); });
+    }
+
+    void setSwitch(const std::string& id, bool on) override { setSwitch(id, on, false); }
+    /// \brief Switches the switch, unless it is known to be in that state or force is set.
+    void setSwitch(const std::string& id, bool on, bool force) {
+        write(switches_, id, on, force, [&] { inner_->setSwitch(id, on); });
+    }
+
+    void setGPIOPin(const std::string& id, bool on) override { setGPIOPin(id, on, false); }
+    /// \brief Sets the gpio pin, unless it is known to be in that state or force is set.
+    ///
+    /// Only writes to pins that a getter reported as outputs are dropped, the state of other pins
+    /// is driven externally or not known.
+    void setGPIOPin(const std::string& id, bool on, bool force) {
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            auto it = pinDirs_.find(id);
+            if (it == pinDirs_.end() || it->second != OUT) {
+                stats_.sent++;
+                gen_++;
+                inner_->setGPIOPin(id, on);
+                return;
+            }
+        }
+        write(pins_, id, on, force, [&] { inner_->setGPIOPin(id, on); });
+    }
+
+    //#############//
+    //### Other ###//
+    //#############//
+
+    void enableGPIOPins() override {
+        std::lock_guard<std::mutex> lock(mx_);
+        pins_.clear();
+        gen_++;
+        inner_->enableGPIOPins();
+    }
+    void disableGPIOPins() override {
+        std::lock_guard<std::mutex> lock(mx_);
+        pins_.clear();
+        gen_++;
+        inner_->disableGPIOPins();
+    }
+    void powerReset() override {
+        std::lock_guard<std::mutex> lock(mx_);
+        forget();
+        inner_->powerReset();
+    }
+
+private:
+    // Clears all known values. Requires mx_.
+    void forget() {
+        motors_.clear();
+        ledOn_.clear();
+        ledStrobe_.clear();
+        ledBrightness_.clear();
+        ledStrobeDelay_.clear();
+        switches_.clear();
+        pins_.clear();
+        status_.clear();
+        gen_++;
+    }
+
+    // Sends a write, unless value is known. The lock is held during the call,
+    // so that the known values follow the order in which the controller received the writes.
+    template<typename V, typename F>
+    void write(std::map<std::string, V>& known, const std::string& id, V value, bool force, F fn) {
+        std::lock_guard<std::mutex> lock(mx_);
+        auto it = known.find(id);
+        if (!force && it != known.end() && it->second == value) {
+            stats_.suppressed++;
+            return;
+        }
+        stats_.sent++;
+        gen_++;
+        try {
+            fn();
+        } catch (...) {
+            known.erase(id);
+            throw;
+        }
+        known[id] = value;
+    }
+
+    // Calls the getter without holding the lock and learns from its result.
+    // If a write was sent meanwhile, the result may predate it and is not learned.
+    template<typename F, typename L>
+    std::invoke_result_t<F> read(F fn, L learnFn) {
+        uint64_t gen;
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            gen = gen_;
+        }
+        auto v = fn();
+        std::lock_guard<std::mutex> lock(mx_);
+        if (gen == gen_) {
+            learnFn(v);
+        }
+        return v;
+    }
+
+    void learn(const StepMotor& sm) {
+        motors_[sm.id] = sm.step;
+    }
+    void learn(const LED& l) {
+        ledOn_[l.id] = l.on;
+        ledStrobe_[l.id] = l.strobeOn;
+        ledBrightness_[l.id] = l.brightness;
+        ledStrobeDelay_[l.id] = l.strobeDelay;
+    }
+    void learn(const GPIOPin& gp) {
+        // Inputs, and IO pins while reading, are driven externally, so only outputs are known.
+        pinDirs_[gp.id] = gp.direction;
+        if (gp.direction == OUT) {
+            pins_[gp.id] = gp.on;
+        } else {
+            pins_.erase(gp.id);
+        }
+    }
+
+    std::map<std::string, int>              motors_;
+    std::map<std::string, bool>             ledOn_;
+    std::map<std::string, bool>             ledStrobe_;
+    std::map<std::string, int>              ledBrightness_;
+    std::map<std::string, int>              ledStrobeDelay_;
+    std::map<std::string, bool>             switches_;
+    std::map<std::string, bool>             pins_;
+    std::map<std::string, GPIOPinDirection> pinDirs_;
+    std::map<std::string, long long int>    status_;
+    DedupStats                              stats_ = {};
+    uint64_t                                gen_   = 0; // Counts the writes sent, to detect writes during a getter.
+    std::mutex                              mx_;
+};
+
+}
+
+#endif
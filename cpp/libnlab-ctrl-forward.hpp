@@ -0,0 +1,68 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the ForwardingController, the base of controllers that wrap another controller.
+#ifndef NLAB_CTRL_LIB_FORWARD_HPP
+#define NLAB_CTRL_LIB_FORWARD_HPP
+
+#include <string>
+#include <vector>
+
+#include <libnlab-ctrl.hpp>
+
+namespace nlab::ctrl {
+
+/// \brief A Controller that forwards every call to another Controller.
+///
+/// Derived classes override only the methods whose behaviour they change.
+class ForwardingController : public Controller {
+public:
+    /// \brief Creates a controller that forwards to inner.
+    explicit ForwardingController(Controller::Ptr inner) : inner_(inner) {}
+
+    /// \brief Returns the wrapped controller.
+    Controller::Ptr inner() const noexcept { return inner_; }
+
+    std::vector<StepMotor> getStepMotors() override { return inner_->getStepMotors(); }
+    StepMotor getStepMotor(const std::string& id) override { return inner_->getStepMotor(id); }
+    void setStepMotorRelPos(const std::string& id, int step) override { inner_->setStepMotorRelPos(id, step); }
+    void setStepMotorAbsPos(const std::string& id, int step) override { inner_->setStepMotorAbsPos(id, step); }
+
+    void setStatusLED(StatusLEDState state) override { inner_->setStatusLED(state); }
+    void setStatusLEDBlinkingDuration(long long int duration) override { inner_->setStatusLEDBlinkingDuration(duration); }
+
+    std::vector<LED> getLEDs() override { return inner_->getLEDs(); }
+    LED getLED(const std::string& id) override { return inner_->getLED(id); }
+    void setLED(const std::string& id, bool on) override { inner_->setLED(id, on); }
+    void setLEDStrobe(const std::string& id, bool on) override { inner_->setLEDStrobe(id, on); }
+    void setLEDBrightness(const std::string& id, int brightness) override { inner_->setLEDBrightness(id, brightness); }
+    void setLEDStrobeDelay(const std::string& id, int delay) override { inner_->setLEDStrobeDelay(id, delay); }
+
+    std::vector<Switch> getSwitches() override { return inner_->getSwitches(); }
+    Switch getSwitch(const std::string& id) override { return inner_->getSwitch(id); }
+    void setSwitch(const std::string& id, bool on) override { inner_->setSwitch(id, on); }
+
+    void enableGPIOPins() override { inner_->enableGPIOPins(); }
+    void disableGPIOPins() override { inner_->disableGPIOPins(); }
+    bool gpioPinsEnabled() noexcept override { return inner_->gpioPinsEnabled(); }
+    std::vector<GPIOPin> getGPIOPins() override { return inner_->getGPIOPins(); }
+    GPIOPin getGPIOPin(const std::string& id) override { return inner_->getGPIOPin(id); }
+    void setGPIOPin(const std::string& id, bool on) override { inner_->setGPIOPin(id, on); }
+
+    float temperature() override { return inner_->temperature(); }
+    void powerReset() override { inner_->powerReset(); }
+    void close() noexcept override { inner_->close(); }
+
+protected:
+    /// \brief The wrapped controller.
+    Controller::Ptr inner_;
+};
+
+}
+
+#endif
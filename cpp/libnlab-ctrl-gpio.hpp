@@ -0,0 +1,128 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the GPIOBank, that reads and writes all gpio pins of a controller as a bitmask.
+#ifndef NLAB_CTRL_LIB_GPIO_HPP
+#define NLAB_CTRL_LIB_GPIO_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+#include <libnlab-ctrl-bulk.hpp>
+
+namespace nlab::ctrl {
+
+/// \brief The states of all pins of a GPIOBank at one instant.
+struct GPIOBankSnapshot {
+    uint64_t                              value;     ///< The on state of the pins, bit i represents GPIOBank::ids()[i].
+    std::chrono::steady_clock::time_point timestamp; ///< The middle of the request, that read the states.
+};
+
+/// \brief Represents all gpio pins of a controller as a bank of up to 64 bits.
+///
+/// Bit i of a mask represents the pin ids()[i], in the order reported by the controller.
+/// The gpio pins must be enabled with Controller::enableGPIOPins(), before the bank is read or written.
+///
+/// All methods may be called from any thread.
+class GPIOBank {
+public:
+    /// \brief Maximum number of pins of a bank.
+    static const size_t MaxPins = 64;
+
+    /// \brief Creates a bank of all gpio pins of the controller.
+    ///
+    /// \throws Exception  If the controller has more than MaxPins pins.
+    GPIOBank(Controller::Ptr ctrl) : ctrl_(ctrl) {
+        GPIOPinStates s = GPIOPinStates::from(ctrl_->getGPIOPins());
+        if (s.size() > MaxPins) {
+            throw Exception(Exception::Generic, "gpio bank: too many pins: " + std::to_string(s.size()));
+        }
+        ids_    = s.ids;
+        for (size_t i = 0; i < ids_.size(); ++i) {
+            bits_.emplace(ids_[i], static_cast<int>(i));
+        }
+        input_  = s.size() > 0 ? s.input[0] : 0;
+        output_ = s.size() > 0 ? s.output[0] : 0;
+    }
+
+    /// \brief Returns the ids of the pins, indexed by their bit.
+    const std::vector<std::string>& ids() const noexcept { return ids_; }
+
+    /// \brief Returns the bit of the pin with the given id, or -1, if there is no such pin.
+    int bit(const std::string& id) const noexcept {
+        auto it = bits_.find(id);
+        return it != bits_.end() ? it->second : -1;
+    }
+
+    /// \brief Returns the mask of pins that can be read, that is with direction IN or IO.
+    uint64_t inputs() const noexcept { return input_; }
+
+    /// \brief Returns the mask of pins that can be written, that is with direction OUT or IO.
+    uint64_t outputs() const noexcept { return output_; }
+
+    /// \brief Reads the states of all pins with a single request.
+    ///
+    /// \return The snapshot of all pins.
+    /// \throws Exception
+    GPIOBankSnapshot readGPIOBank() {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<GPIOPin> gps = ctrl_->getGPIOPins();
+        auto end = std::chrono::steady_clock::now();
+
+        GPIOBankSnapshot s;
+        s.value = 0;
+        s.timestamp = start + (end - start) / 2;
+        for (size_t i = 0; i < gps.size(); ++i) {
+            if (!gps[i].on) {
+                continue;
+            }
+            // The controller usually reports the pins in the order of the bank.
+            int b = i < ids_.size() && ids_[i] == gps[i].id ? static_cast<int>(i) : bit(gps[i].id);
+            if (b >= 0) {
+                s.value |= uint64_t(1) << b;
+            }
+        }
+        return s;
+    }
+
+    /// \brief Sets the pins selected by mask to the corresponding bits of value.
+    ///
+    /// The pins are set back to back, in ascending bit order. Concurrent writes to the bank are serialized.
+    ///
+    /// \param[in]  mask   The pins to set.
+    /// \param[in]  value  The on state of each pin in mask.
+    ///
+    /// \throws Exception  If mask selects a pin that is not an output, or setting a pin failed.
+    void writeGPIOBank(uint64_t mask, uint64_t value) {
+        if (mask & ~output_) {
+            throw Exception(Exception::Generic, "gpio bank: mask selects pins that are not outputs");
+        }
+
+        std::lock_guard<std::mutex> lock(mx_);
+        for (uint64_t m = mask; m != 0; m &= m - 1) {
+            int b = __builtin_ctzll(m);
+            ctrl_->setGPIOPin(ids_[b], (value >> b) & 1);
+        }
+    }
+
+private:
+    Controller::Ptr                      ctrl_;
+    std::vector<std::string>             ids_;
+    std::unordered_map<std::string, int> bits_;
+    uint64_t                             input_  = 0;
+    uint64_t                             output_ = 0;
+    std::mutex                           mx_;
+};
+
+}
+
+#endif
@@ -0,0 +1,961 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the IPC server and client to share controllers over a Unix domain socket.
+///
+/// The Server runs inside a daemon process (see daemon/main.cpp) and serves every Controller
+/// it opened to any number of local clients. The client side is a regular Controller,
+/// so existing code works unchanged once it obtains its Ptr with ipc::open().
+///
+/// Wire format: every message is a frame consisting of a 9 byte header followed by its payload.
+/// The header contains the payload size (uint32), a sequence number (uint32) and the opcode of a
+/// request or the status of a response (uint8). All values are encoded in host byte order,
+/// as both peers always run on the same machine. Strings are prefixed with their size (uint16),
+/// longer strings are rejected.
+///
+/// Requests are processed strictly in order per connection, so clients may pipeline any number
+/// of requests without waiting for their responses.
+#ifndef NLAB_CTRL_LIB_IPC_HPP
+#define NLAB_CTRL_LIB_IPC_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <libnlab-ctrl.hpp>
+
+namespace nlab::ctrl::ipc {
+
+/// \brief The socket path used, if none is specified.
+inline const std::string DefaultSocketPath = "/run/nlab-ctrl.sock";
+
+/// \brief The maximum size of a single frame payload.
+const uint32_t MaxFrameSize = 1 << 20;
+
+/// \brief The maximum size of the responses the server buffers for a client, that does not read them.
+///
+/// The server stops reading requests of the client until it drained its responses below this size.
+const size_t MaxPendingOutput = 4 << 20;
+
+//################//
+//### Protocol ###//
+//################//
+
+/// \brief The opcode of a request frame.
+enum class Op : uint8_t {
+    List = 1,
+    Open,
+    Close,
+    GetStepMotors,
+    GetStepMotor,
+    SetStepMotorRelPos,
+    SetStepMotorAbsPos,
+    SetStatusLED,
+    SetStatusLEDBlinkingDuration,
+    GetLEDs,
+    GetLED,
+    SetLED,
+    SetLEDStrobe,
+    SetLEDBrightness,
+    SetLEDStrobeDelay,
+    GetSwitches,
+    GetSwitch,
+    SetSwitch,
+    EnableGPIOPins,
+    DisableGPIOPins,
+    GPIOPinsEnabled,
+    GetGPIOPins,
+    GetGPIOPin,
+    SetGPIOPin,
+    Temperature,
+    PowerReset
+};
+
+/// \brief The status of a response frame.
+///
+/// Any status other than Status::OK carries the error message as payload.
+enum class Status : uint8_t {
+    OK       = 0, ///< The request succeeded.
+    Generic  = 1, ///< Maps to Exception::Generic.
+    NotFound = 2  ///< Maps to Exception::NotFound.
+};
+
+/// \brief The header that precedes every frame.
+struct FrameHeader {
+    uint32_t size; ///< Size of the payload in bytes.
+    uint32_t seq;  ///< Sequence number, echoed in the response.
+    uint8_t  code; ///< Op of a request or Status of a response.
+};
+
+/// \brief Size of the encoded FrameHeader.
+const size_t FrameHeaderSize = 9;
+
+/// \brief Appends values in wire format to a byte buffer.
+class Writer {
+public:
+    /// \brief Creates a Writer that appends to buf.
+    explicit Writer(std::string& buf) : buf_(buf) {}
+
+    /// \brief Appends a frame header and returns its offset for a later finish().
+    size_t begin(uint32_t seq, uint8_t code) {
+        size_t off = buf_.size();
+        u32(0);
+        u32(seq);
+        u8(code);
+        return off;
+    }
+
+    /// \brief Patches the payload size of the frame started at off.
+    void finish(size_t off) {
+        uint32_t size = static_cast<uint32_t>(buf_.size() - off - FrameHeaderSize);
+        std::memcpy(&buf_[off], &size, sizeof(size));
+    }
+
+    void u8(uint8_t v)         { raw(&v, sizeof(v)); }
+    void u16(uint16_t v)       { raw(&v, sizeof(v)); }
+    void u32(uint32_t v)       { raw(&v, sizeof(v)); }
+    void i32(int v)            { int32_t w = v; raw(&w, sizeof(w)); }
+    void i64(long long int v)  { int64_t w = v; raw(&w, sizeof(w)); }
+    void f32(float v)          { raw(&v, sizeof(v)); }
+    void boolean(bool v)       { u8(v ? 1 : 0); }
+    void str(const std::string& s) {
+        if (s.size() > UINT16_MAX) {
+            throw Exception(Exception::Generic, "ipc: string too long");
+        }
+        u16(static_cast<uint16_t>(s.size()));
+        raw(s.data(), s.size());
+    }
+
+    void stepMotor(const StepMotor& sm) { str(sm.id); str(sm.name); i32(sm.step); i32(sm.minStep); i32(sm.maxStep); }
+    void led(const LED& l)              { str(l.id); str(l.name); boolean(l.on); i32(l.brightness); boolean(l.strobeOn); i32(l.strobeDelay); }
+    void sw(const Switch& s)            { str(s.id); str(s.name); boolean(s.on); }
+    void gpioPin(const GPIOPin& gp)     { str(gp.id); str(gp.name); u8(gp.direction); boolean(gp.on); }
+    void info(const Info& inf)          { str(inf.backendID); str(inf.id); str(inf.devPath); }
+
+    /// \brief Appends a list, prefixed by its size.
+    template<typename T, typename F>
+    void list(const std::vector<T>& v, F f) {
+        u32(static_cast<uint32_t>(v.size()));
+        for (const auto& e : v) {
+            (this->*f)(e);
+        }
+    }
+
+private:
+    void raw(const void* p, size_t n) { buf_.append(static_cast<const char*>(p), n); }
+
+    std::string& buf_;
+};
+
+/// \brief Reads values in wire format from a frame payload.
+///
+/// Throws an Exception, if the payload is shorter than expected.
+class Reader {
+public:
+    /// \brief Creates a Reader for the n bytes at p.
+    Reader(const char* p, size_t n) : p_(p), end_(p + n) {}
+
+    uint8_t       u8()      { uint8_t v;  raw(&v, sizeof(v)); return v; }
+    uint16_t      u16()     { uint16_t v; raw(&v, sizeof(v)); return v; }
+    uint32_t      u32()     { uint32_t v; raw(&v, sizeof(v)); return v; }
+    int           i32()     { int32_t v;  raw(&v, sizeof(v)); return v; }
+    long long int i64()     { int64_t v;  raw(&v, sizeof(v)); return v; }
+    float         f32()     { float v;    raw(&v, sizeof(v)); return v; }
+    bool          boolean() { return u8() != 0; }
+    std::string   str() {
+        uint16_t len = u16();
+        need(len);
+        std::string s(p_, len);
+        p_ += len;
+        return s;
+    }
+
+    StepMotor stepMotor() { StepMotor sm; sm.id = str(); sm.name = str(); sm.step = i32(); sm.minStep = i32(); sm.maxStep = i32(); return sm; }
+    LED       led()       { LED l; l.id = str(); l.name = str(); l.on = boolean(); l.brightness = i32(); l.strobeOn = boolean(); l.strobeDelay = i32(); return l; }
+    Switch    sw()        { Switch s; s.id = str(); s.name = str(); s.on = boolean(); return s; }
+    GPIOPin   gpioPin()   { GPIOPin gp; gp.id = str(); gp.name = str(); gp.direction = static_cast<GPIOPinDirection>(u8()); gp.on = boolean(); return gp; }
+    Info      info()      { Info inf; inf.backendID = str(); inf.id = str(); inf.devPath = str(); return inf; }
+
+    /// \brief Reads a list, prefixed by its size.
+    template<typename T>
+    std::vector<T> list(T (Reader::*f)()) {
+        uint32_t n = u32();
+        std::vector<T> v;
+        v.reserve(n < 1024 ? n : 1024);
+        for (uint32_t i = 0; i < n; ++i) {
+            v.push_back((this->*f)());
+        }
+        return v;
+    }
+
+private:
+    void need(size_t n) {
+        if (static_cast<size_t>(end_ - p_) < n) {
+            throw Exception(Exception::Generic, "ipc: malformed frame");
+        }
+    }
+    void raw(void* v, size_t n) { need(n); std::memcpy(v, p_, n); p_ += n; }
+
+    const char* p_;
+    const char* end_;
+};
+
+/// \brief Decodes the frame header at the start of buf, if it is complete.
+inline bool peekFrame(const std::string& buf, size_t off, FrameHeader& h) {
+    if (buf.size() - off < FrameHeaderSize) {
+        return false;
+    }
+    std::memcpy(&h.size, &buf[off], sizeof(h.size));
+    std::memcpy(&h.seq, &buf[off + 4], sizeof(h.seq));
+    h.code = static_cast<uint8_t>(buf[off + 8]);
+    return true;
+}
+
+//##############//
+//### Server ###//
+//##############//
+
+/// \brief Serves opened controllers to local clients over a Unix domain socket.
+///
+/// A controller is opened once per backend id and device path and shared by all clients,
+/// that open the same combination. It is closed, once its last client closed it or disconnected.
+/// The options of the first open call are used.
+///
+/// All requests are handled on the thread calling run(). Responses are buffered per client
+/// and written once its socket is writable, so a client that does not read its responses
+/// never blocks the others.
+class Server {
+public:
+    /// \brief Creates a server listening on the given socket path.
+    ///
+    /// A stale socket file at the path is removed. It fails, if another server listens on the path.
+    ///
+    /// \throws Exception
+    explicit Server(const std::string& socketPath = DefaultSocketPath) : path_(socketPath) {
+        if (::pipe2(wake_, O_CLOEXEC | O_NONBLOCK) != 0) {
+            throw Exception(Exception::Generic, "ipc: pipe: " + std::string(std::strerror(errno)));
+        }
+
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (path_.size() >= sizeof(addr.sun_path)) {
+            closeFds();
+            throw Exception(Exception::Generic, "ipc: socket path too long: " + path_);
+        }
+        std::strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+
+        lfd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (lfd_ < 0) {
+            closeFds();
+            throw Exception(Exception::Generic, "ipc: socket: " + std::string(std::strerror(errno)));
+        }
+        // Only remove a stale socket, never a file or the socket of a running server.
+        struct stat st;
+        if (::lstat(path_.c_str(), &st) == 0) {
+            if (!S_ISSOCK(st.st_mode) || listening(addr)) {
+                closeFds();
+                throw Exception(Exception::Generic, "ipc: listen on " + path_ + ": " + std::strerror(EADDRINUSE));
+            }
+            ::unlink(path_.c_str());
+        }
+        if (::bind(lfd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(lfd_, 64) != 0) {
+            std::string msg = "ipc: listen on " + path_ + ": " + std::strerror(errno);
+            closeFds();
+            throw Exception(Exception::Generic, msg);
+        }
+    }
+
+    ~Server() {
+        for (auto& c : clients_) {
+            releaseAll(c.second);
+            ::close(c.first);
+        }
+        for (auto& s : sessions_) {
+            s.second.ctrl->close();
+        }
+        closeFds();
+        ::unlink(path_.c_str());
+    }
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    /// \brief Serves clients until stop() is called.
+    void run() {
+        std::vector<pollfd> pfds;
+        std::vector<int> fds;
+        while (!stopped_) {
+            pfds.clear();
+            fds.clear();
+            pfds.push_back({wake_[0], POLLIN, 0});
+            pfds.push_back({lfd_, POLLIN, 0});
+            for (const auto& c : clients_) {
+                short events = c.second.out.size() < MaxPendingOutput ? POLLIN : 0;
+                if (!c.second.out.empty()) {
+                    events |= POLLOUT;
+                }
+                pfds.push_back({c.first, events, 0});
+                fds.push_back(c.first);
+            }
+
+            if (::poll(pfds.data(), pfds.size(), -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            if (pfds[1].revents & POLLIN) {
+                accept();
+            }
+            for (size_t i = 0; i < fds.size(); ++i) {
+                short revents = pfds[i + 2].revents;
+                bool ok = true;
+                if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                    ok = serve(fds[i]);
+                }
+                if (ok && (revents & POLLOUT)) {
+                    // Room in the output may allow handling frames left over at MaxPendingOutput.
+                    ok = process(clients_[fds[i]], fds[i]);
+                }
+                if (!ok) {
+                    disconnect(fds[i]);
+                }
+            }
+        }
+    }
+
+    /// \brief Makes run() return. Safe to call from any thread or a signal handler.
+    void stop() noexcept {
+        stopped_ = true;
+        char b = 0;
+        (void)!::write(wake_[1], &b, 1);
+    }
+
+private:
+    struct Session {
+        Controller::Ptr ctrl;
+        int             refs;
+    };
+
+    struct Client {
+        std::string             in;
+        std::string             out;
+        std::multiset<uint32_t> handles;
+    };
+
+    // Returns true, if a server accepts connections on addr.
+    static bool listening(const sockaddr_un& addr) {
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (fd < 0) {
+            return false;
+        }
+        // A full backlog fails with EAGAIN, but the server is still running.
+        bool ok = ::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0 || errno == EAGAIN;
+        ::close(fd);
+        return ok;
+    }
+
+    void accept() {
+        for (;;) {
+            int fd = ::accept4(lfd_, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (fd < 0) {
+                return;
+            }
+            clients_[fd];
+        }
+    }
+
+    void disconnect(int fd) {
+        auto it = clients_.find(fd);
+        if (it != clients_.end()) {
+            releaseAll(it->second);
+            clients_.erase(it);
+        }
+        ::close(fd);
+    }
+
+    // Reads all pending data and queues the responses to every complete frame.
+    bool serve(int fd) {
+        Client& c = clients_[fd];
+        char buf[16384];
+        for (;;) {
+            ssize_t n = ::read(fd, buf, sizeof(buf));
+            if (n > 0) {
+                c.in.append(buf, n);
+                continue;
+            }
+            if (n == 0) {
+                return false;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                break;
+            }
+            return false;
+        }
+        return process(c, fd);
+    }
+
+    // Handles the complete frames received and sends their responses, until no complete frame is left
+    // or MaxPendingOutput is reached, because the client does not read its responses.
+    bool process(Client& c, int fd) {
+        for (;;) {
+            size_t off = 0;
+            FrameHeader h;
+            while (c.out.size() < MaxPendingOutput && peekFrame(c.in, off, h)) {
+                if (h.size > MaxFrameSize) {
+                    return false;
+                }
+                if (c.in.size() - off - FrameHeaderSize < h.size) {
+                    break;
+                }
+                handle(c, h, c.in.data() + off + FrameHeaderSize, c.out);
+                off += FrameHeaderSize + h.size;
+            }
+            c.in.erase(0, off);
+
+            if (!drain(c, fd)) {
+                return false;
+            }
+            if (off == 0 || c.out.size() >= MaxPendingOutput) {
+                return true;
+            }
+        }
+    }
+
+    // Writes as much of the queued responses as the socket accepts without blocking.
+    bool drain(Client& c, int fd) {
+        size_t off = 0;
+        while (off < c.out.size()) {
+            ssize_t w = ::send(fd, c.out.data() + off, c.out.size() - off, MSG_NOSIGNAL);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN) {
+                    break;
+                }
+                return false;
+            }
+            off += w;
+        }
+        c.out.erase(0, off);
+        return true;
+    }
+
+    void handle(Client& c, const FrameHeader& h, const char* payload, std::string& out) {
+        Writer w(out);
+        size_t mark = out.size();
+        size_t off = w.begin(h.seq, static_cast<uint8_t>(Status::OK));
+        try {
+            Reader r(payload, h.size);
+            dispatch(c, static_cast<Op>(h.code), r, w);
+        } catch (Exception& e) {
+            out.resize(mark);
+            off = w.begin(h.seq, static_cast<uint8_t>(e.code() == Exception::NotFound ? Status::NotFound : Status::Generic));
+            w.str(std::string(e.what()).substr(0, UINT16_MAX));
+        } catch (std::exception& e) {
+            out.resize(mark);
+            off = w.begin(h.seq, static_cast<uint8_t>(Status::Generic));
+            w.str(std::string(e.what()).substr(0, UINT16_MAX));
+        }
+        w.finish(off);
+    }
+
+    void dispatch(Client& c, Op op, Reader& r, Writer& w) {
+        if (op == Op::List) {
+            w.list(Controller::list(), &Writer::info);
+            return;
+        } else if (op == Op::Open) {
+            std::string backendID = r.str();
+            std::string devPath = r.str();
+            ControllerOpts opts;
+            opts.stateDir = r.str();
+            w.u32(acquire(c, backendID, devPath, opts));
+            return;
+        }
+
+        uint32_t handle = r.u32();
+        auto it = handles_.find(handle);
+        if (it == handles_.end() || c.handles.count(handle) == 0) {
+            throw Exception(Exception::Generic, "ipc: invalid controller handle");
+        }
+        Controller::Ptr ctrl = it->second->second.ctrl;
+
+        switch (op) {
+        case Op::Close:                        release(c, handle); break;
+        case Op::GetStepMotors:                w.list(ctrl->getStepMotors(), &Writer::stepMotor); break;
+        case Op::GetStepMotor:                 w.stepMotor(ctrl->getStepMotor(r.str())); break;
+        case Op::SetStepMotorRelPos:           { auto id = r.str(); ctrl->setStepMotorRelPos(id, r.i32()); break; }
+        case Op::SetStepMotorAbsPos:           { auto id = r.str(); ctrl->setStepMotorAbsPos(id, r.i32()); break; }
+        case Op::SetStatusLED:                 ctrl->setStatusLED(static_cast<StatusLEDState>(r.u8())); break;
+        case Op::SetStatusLEDBlinkingDuration: ctrl->setStatusLEDBlinkingDuration(r.i64()); break;
+        case Op::GetLEDs:                      w.list(ctrl->getLEDs(), &Writer::led); break;
+        case Op::GetLED:                       w.led(ctrl->getLED(r.str())); break;
+        case Op::SetLED:                       { auto id = r.str(); ctrl->setLED(id, r.boolean()); break; }
+        case Op::SetLEDStrobe:                 { auto id = r.str(); ctrl->setLEDStrobe(id, r.boolean()); break; }
+        case Op::SetLEDBrightness:             { auto id = r.str(); ctrl->setLEDBrightness(id, r.i32()); break; }
+        case Op::SetLEDStrobeDelay:            { auto id = r.str(); ctrl->setLEDStrobeDelay(id, r.i32()); break; }
+        case Op::GetSwitches:                  w.list(ctrl->getSwitches(), &Writer::sw); break;
+        case Op::GetSwitch:                    w.sw(ctrl->getSwitch(r.str())); break;
+        case Op::SetSwitch:                    { auto id = r.str(); ctrl->setSwitch(id, r.boolean()); break; }
+        case Op::EnableGPIOPins:               ctrl->enableGPIOPins(); break;
+        case Op::DisableGPIOPins:              ctrl->disableGPIOPins(); break;
+        case Op::GPIOPinsEnabled:              w.boolean(ctrl->gpioPinsEnabled()); break;
+        case Op::GetGPIOPins:                  w.list(ctrl->getGPIOPins(), &Writer::gpioPin); break;
+        case Op::GetGPIOPin:                   w.gpioPin(ctrl->getGPIOPin(r.str())); break;
+        case Op::SetGPIOPin:                   { auto id = r.str(); ctrl->setGPIOPin(id, r.boolean()); break; }
+        case Op::Temperature:                  w.f32(ctrl->temperature()); break;
+        case Op::PowerReset:                   ctrl->powerReset(); break;
+        default:
+            throw Exception(Exception::Generic, "ipc: invalid request code");
+        }
+    }
+
+    uint32_t acquire(Client& c, const std::string& backendID, const std::string& devPath, const ControllerOpts& opts) {
+        std::string key = backendID + '\n' + devPath;
+        auto it = sessions_.find(key);
+        if (it == sessions_.end()) {
+            Controller::Ptr ctrl = Controller::open(backendID, devPath, opts);
+            it = sessions_.emplace(key, Session{ctrl, 0}).first;
+            keys_[key] = nextHandle_++;
+            handles_[keys_[key]] = it;
+        }
+        it->second.refs++;
+
+        uint32_t handle = keys_[key];
+        c.handles.insert(handle);
+        return handle;
+    }
+
+    void release(Client& c, uint32_t handle) {
+        auto cit = c.handles.find(handle);
+        if (cit == c.handles.end()) {
+            return;
+        }
+        c.handles.erase(cit);
+
+        auto it = handles_[handle];
+        if (--it->second.refs == 0) {
+            it->second.ctrl->close();
+            keys_.erase(it->first);
+            sessions_.erase(it);
+            handles_.erase(handle);
+        }
+    }
+
+    void releaseAll(Client& c) {
+        while (!c.handles.empty()) {
+            release(c, *c.handles.begin());
+        }
+    }
+
+    void closeFds() {
+        for (int* fd : {&lfd_, &wake_[0], &wake_[1]}) {
+            if (*fd >= 0) {
+                ::close(*fd);
+                *fd = -1;
+            }
+        }
+    }
+
+    std::string       path_;
+    int               lfd_     = -1;
+    int               wake_[2] = {-1, -1};
+    std::atomic<bool> stopped_{false};
+
+    std::map<int, Client>                                        clients_;
+    std::map<std::string, Session>                               sessions_;
+    std::map<std::string, uint32_t>                              keys_;
+    std::map<uint32_t, std::map<std::string, Session>::iterator> handles_;
+    uint32_t                                                     nextHandle_ = 1;
+};
+
+//##############//
+//### Client ###//
+//##############//
+
+/// \brief A connection to a Server.
+///
+/// Sends requests and awaits their responses. Requests queued with queue() are pipelined:
+/// they are sent at once by flush(), which collects their responses while sending.
+///
+/// This class is thread-safe.
+class Client {
+public:
+    /// \brief A type definition for a shared instance of a Client.
+    typedef std::shared_ptr<Client> Ptr;
+
+    /// \brief Connects to the server listening on socketPath.
+    ///
+    /// \throws Exception
+    explicit Client(const std::string& socketPath = DefaultSocketPath) {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(addr.sun_path)) {
+            throw Exception(Exception::Generic, "ipc: socket path too long: " + socketPath);
+        }
+        std::strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+        fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd_ < 0) {
+            throw Exception(Exception::Generic, "ipc: socket: " + std::string(std::strerror(errno)));
+        }
+        if (::connect(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            std::string msg = "ipc: connect to " + socketPath + ": " + std::strerror(errno);
+            ::close(fd_);
+            throw Exception(Exception::Generic, msg);
+        }
+    }
+
+    ~Client() {
+        ::close(fd_);
+    }
+
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    /// \brief Sends a request and returns the payload of its response.
+    ///
+    /// All queued requests are flushed before.
+    ///
+    /// \param[in]  op    The opcode of the request.
+    /// \param[in]  body  Encodes the payload of the request.
+    ///
+    /// \throws Exception
+    template<typename F>
+    std::string call(Op op, F body) {
+        std::lock_guard<std::mutex> lock(mx_);
+        encode(op, body);
+        std::string resp;
+        flushLocked(&resp);
+        return resp;
+    }
+
+    /// \brief Queues a request without waiting for its response.
+    ///
+    /// \param[in]  op    The opcode of the request.
+    /// \param[in]  body  Encodes the payload of the request.
+    template<typename F>
+    void queue(Op op, F body) {
+        std::lock_guard<std::mutex> lock(mx_);
+        encode(op, body);
+    }
+
+    /// \brief Sends all queued requests and awaits their responses.
+    ///
+    /// \throws Exception of the first failed request.
+    void flush() {
+        std::lock_guard<std::mutex> lock(mx_);
+        flushLocked(nullptr);
+    }
+
+private:
+    template<typename F>
+    void encode(Op op, F body) {
+        Writer w(out_);
+        size_t off = w.begin(seq_ + 1, static_cast<uint8_t>(op));
+        try {
+            body(w);
+        } catch (...) {
+            out_.resize(off);
+            throw;
+        }
+        w.finish(off);
+        seq_++;
+        pending_++;
+    }
+
+    // Sends the queued requests and reads their responses.
+    // The payload of the last response is stored in last.
+    void flushLocked(std::string* last) {
+        if (pending_ == 0) {
+            return;
+        }
+        int n = pending_;
+        pending_ = 0;
+        std::string out;
+        out.swap(out_);
+        sendAll(out);
+
+        bool failed = false;
+        Exception::ErrCode code = Exception::Generic;
+        std::string msg;
+        for (int i = 0; i < n; ++i) {
+            FrameHeader h;
+            while (!peekFrame(in_, 0, h) || in_.size() - FrameHeaderSize < h.size) {
+                fill();
+            }
+            std::string payload = in_.substr(FrameHeaderSize, h.size);
+            in_.erase(0, FrameHeaderSize + h.size);
+
+            if (h.code != static_cast<uint8_t>(Status::OK)) {
+                if (!failed) {
+                    failed = true;
+                    code = h.code == static_cast<uint8_t>(Status::NotFound) ? Exception::NotFound : Exception::Generic;
+                    msg = Reader(payload.data(), payload.size()).str();
+                }
+            } else if (i == n - 1 && last != nullptr) {
+                last->swap(payload);
+            }
+        }
+        if (failed) {
+            throw Exception(code, msg);
+        }
+    }
+
+    // Writes all of out. Responses that arrive meanwhile are read into in_, because the server stops
+    // reading requests while the responses it could not send exceed MaxPendingOutput.
+    void sendAll(const std::string& out) {
+        size_t off = 0;
+        while (off < out.size()) {
+            pollfd pfd = {fd_, POLLIN | POLLOUT, 0};
+            if (::poll(&pfd, 1, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw Exception(Exception::Generic, "ipc: poll: " + std::string(std::strerror(errno)));
+            }
+            if (pfd.revents & POLLIN) {
+                fill();
+            }
+            if (pfd.revents & (POLLOUT | POLLERR | POLLHUP)) {
+                ssize_t w = ::send(fd_, out.data() + off, out.size() - off, MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (w < 0) {
+                    if (errno == EINTR || errno == EAGAIN) {
+                        continue;
+                    }
+                    throw Exception(Exception::Generic, "ipc: write: " + std::string(std::strerror(errno)));
+                }
+                off += w;
+            }
+        }
+    }
+
+    void fill() {
+        char buf[16384];
+        for (;;) {
+            ssize_t n = ::read(fd_, buf, sizeof(buf));
+            if (n > 0) {
+                in_.append(buf, n);
+                return;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            throw Exception(Exception::Generic, n == 0 ? "ipc: connection closed" : "ipc: read: " + std::string(std::strerror(errno)));
+        }
+    }
+
+    int         fd_ = -1;
+    std::mutex  mx_;
+    std::string out_;
+    std::string in_;
+    uint32_t    seq_     = 0;
+    int         pending_ = 0;
+};
+
+/// \brief A Controller that forwards all calls to a controller served by a Server.
+///
+/// Setters may be pipelined by wrapping them between beginBatch() and commitBatch().
+class RemoteController : public Controller {
+public:
+    /// \brief Creates a RemoteController for the given server handle.
+    ///
+    /// Use ipc::open() instead.
+    RemoteController(Client::Ptr client, uint32_t handle) : client_(client), handle_(handle) {}
+
+    ~RemoteController() {
+        close();
+    }
+
+    /// \brief Starts a batch.
+    ///
+    /// Until commitBatch() is called, all setters are queued instead of sent
+    /// and never throw. Getters flush the batch before they are sent.
+    void beginBatch() noexcept { batch_ = true; }
+
+    /// \brief Sends all setters queued since beginBatch() at once and awaits their results.
+    ///
+    /// \throws Exception of the first failed setter.
+    void commitBatch() {
+        batch_ = false;
+        client_->flush();
+    }
+
+    std::vector<StepMotor> getStepMotors() override {
+        return get(Op::GetStepMotors, [](Reader& r) { return r.list(&Reader::stepMotor); });
+    }
+    StepMotor getStepMotor(const std::string& id) override {
+        return get(Op::GetStepMotor, [](Reader& r) { return r.stepMotor(); }, id);
+    }
+    void setStepMotorRelPos(const std::string& id, int step) override {
+        set(Op::SetStepMotorRelPos, [&](Writer& w) { w.str(id); w.i32(step); });
+    }
+    void setStepMotorAbsPos(const std::string& id, int step) override {
+        set(Op::SetStepMotorAbsPos, [&](Writer& w) { w.str(id); w.i32(step); });
+    }
+    void setStatusLED(StatusLEDState state) override {
+        set(Op::SetStatusLED, [&](Writer& w) { w.u8(state); });
+    }
+    void setStatusLEDBlinkingDuration(long long int duration) override {
+        set(Op::SetStatusLEDBlinkingDuration, [&](Writer& w) { w.i64(duration); });
+    }
+    std::vector<LED> getLEDs() override {
+        return get(Op::GetLEDs, [](Reader& r) { return r.list(&Reader::led); });
+    }
+    LED getLED(const std::string& id) override {
+        return get(Op::GetLED, [](Reader& r) { return r.led(); }, id);
+    }
+    void setLED(const std::string& id, bool on) override {
+        set(Op::SetLED, [&](Writer& w) { w.str(id); w.boolean(on); });
+    }
+    void setLEDStrobe(const std::string& id, bool on) override {
+        set(Op::SetLEDStrobe, [&](Writer& w) { w.str(id); w.boolean(on); });
+    }
+    void setLEDBrightness(const std::string& id, int brightness) override {
+        set(Op::SetLEDBrightness, [&](Writer& w) { w.str(id); w.i32(brightness); });
+    }
+    void setLEDStrobeDelay(const std::string& id, int delay) override {
+        set(Op::SetLEDStrobeDelay, [&](Writer& w) { w.str(id); w.i32(delay); });
+    }
+    std::vector<Switch> getSwitches() override {
+        return get(Op::GetSwitches, [](Reader& r) { return r.list(&Reader::sw); });
+    }
+    Switch getSwitch(const std::string& id) override {
+        return get(Op::GetSwitch, [](Reader& r) { return r.sw(); }, id);
+    }
+    void setSwitch(const std::string& id, bool on) override {
+        set(Op::SetSwitch, [&](Writer& w) { w.str(id); w.boolean(on); });
+    }
+    void enableGPIOPins() override {
+        set(Op::EnableGPIOPins, [](Writer&) {});
+    }
+    void disableGPIOPins() override {
+        set(Op::DisableGPIOPins, [](Writer&) {});
+    }
+    bool gpioPinsEnabled() noexcept override {
+        try {
+            return get(Op::GPIOPinsEnabled, [](Reader& r) { return r.boolean(); });
+        } catch (Exception&) {
+            return false;
+        }
+    }
+    std::vector<GPIOPin> getGPIOPins() override {
+        return get(Op::GetGPIOPins, [](Reader& r) { return r.list(&Reader::gpioPin); });
+    }
+    GPIOPin getGPIOPin(const std::string& id) override {
+        return get(Op::GetGPIOPin, [](Reader& r) { return r.gpioPin(); }, id);
+    }
+    void setGPIOPin(const std::string& id, bool on) override {
+        set(Op::SetGPIOPin, [&](Writer& w) { w.str(id); w.boolean(on); });
+    }
+    float temperature() override {
+        return get(Op::Temperature, [](Reader& r) { return r.f32(); });
+    }
+    void powerReset() override {
+        set(Op::PowerReset, [](Writer&) {});
+    }
+    void close() noexcept override {
+        if (closed_.exchange(true)) {
+            return;
+        }
+        try {
+            batch_ = false;
+            client_->call(Op::Close, [&](Writer& w) { w.u32(handle_); });
+        } catch (Exception&) {}
+    }
+
+private:
+    template<typename D>
+    std::invoke_result_t<D, Reader&> get(Op op, D decode) {
+        std::string resp = client_->call(op, [&](Writer& w) { w.u32(handle_); });
+        Reader r(resp.data(), resp.size());
+        return decode(r);
+    }
+
+    template<typename D>
+    std::invoke_result_t<D, Reader&> get(Op op, D decode, const std::string& id) {
+        std::string resp = client_->call(op, [&](Writer& w) { w.u32(handle_); w.str(id); });
+        Reader r(resp.data(), resp.size());
+        return decode(r);
+    }
+
+    template<typename F>
+    void set(Op op, F body) {
+        auto f = [&](Writer& w) { w.u32(handle_); body(w); };
+        if (batch_) {
+            client_->queue(op, f);
+        } else {
+            client_->call(op, f);
+        }
+    }
+
+    Client::Ptr       client_;
+    uint32_t          handle_;
+    std::atomic<bool> batch_{false};
+    std::atomic<bool> closed_{false};
+};
+
+/// \brief Lists the controllers available to the server.
+///
+/// \param[in]  socketPath  The socket path of the server.
+///
+/// \return A list of Info structs.
+/// \throws Exception
+inline std::vector<Info> list(const std::string& socketPath = DefaultSocketPath) {
+    Client client(socketPath);
+    std::string resp = client.call(Op::List, [](Writer&) {});
+    Reader r(resp.data(), resp.size());
+    return r.list(&Reader::info);
+}
+
+/// \brief Opens a controller served by the server on socketPath.
+///
+/// Several processes may open the same controller, they all share one connection to the device.
+/// The options are only applied, if the server has not opened the controller yet.
+///
+/// \param[in]  backendID   The id of the backend the server should use.
+/// \param[in]  devPath     The device path on the host.
+/// \param[in]  opts        Optional parameters of the controller.
+/// \param[in]  socketPath  The socket path of the server.
+///
+/// \return A Ptr to a Controller ready to use. It can be cast to a RemoteController to use batches.
+/// \throws Exception
+inline Controller::Ptr open(const std::string& backendID, const std::string& devPath, const ControllerOpts& opts,
+                            const std::string& socketPath = DefaultSocketPath) {
+    auto client = std::make_shared<Client>(socketPath);
+    std::string resp = client->call(Op::Open, [&](Writer& w) {
+        w.str(backendID);
+        w.str(devPath);
+        w.str(opts.stateDir);
+    });
+    Reader r(resp.data(), resp.size());
+    return std::make_shared<RemoteController>(client, r.u32());
+}
+
+}
+
+#endif
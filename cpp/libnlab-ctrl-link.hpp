@@ -0,0 +1,215 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the LinkController, that retries failed calls based on the measured quality of the link.
+///
+/// Baud rate and timeouts of the serial link are fixed inside the core library.
+/// The LinkController measures the round trip of every call instead, keeps a smoothed estimate
+/// and its variance, as TCP does for its retransmission timeout, and derives from them how long to back off
+/// before retrying a call that failed, e.g. with a spurious timeout on a long USB run.
+/// A retry is only started, if it is expected to finish within a latency budget per call.
+/// The budget bounds when retries start, not the total latency: a retry that hits the fixed timeout
+/// of the core library still takes that long.
+#ifndef NLAB_CTRL_LIB_LINK_HPP
+#define NLAB_CTRL_LIB_LINK_HPP
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#include <libnlab-ctrl.hpp>
+#include <libnlab-ctrl-forward.hpp>
+
+namespace nlab::ctrl {
+
+/// \brief Options for a LinkController.
+///
+/// For every member that is not set a sensible default value is used. This means that an empty struct represents default options.
+struct LinkOpts {
+    /// \brief Maximum number of retries of a failed call. Defaults to 2.
+    int retries = 2;
+
+    /// \brief Time after the start of a call, by which all retries are expected to finish. Defaults to 2 seconds.
+    ///
+    /// A retry is only started, if the backoff and the expected duration of the attempt fit into the remaining budget.
+    /// The expected duration is the larger of the expected round trip and the duration of the failed attempt,
+    /// as a failure often is a timeout, that the next attempt may hit again.
+    std::chrono::milliseconds budget = std::chrono::milliseconds(2000);
+
+    /// \brief Lower bound of the backoff before a retry. Defaults to 5 milliseconds.
+    std::chrono::milliseconds minBackoff = std::chrono::milliseconds(5);
+
+    /// \brief Retries Controller::setStepMotorRelPos() and Controller::powerReset() as well. Defaults to false.
+    ///
+    /// A failed call may still have reached the controller, so retrying these calls can repeat their effect. \n
+    /// Controller::enableGPIOPins() and Controller::disableGPIOPins() are only retried, if the pins did not switch.
+    bool retryAll = false;
+};
+
+/// \brief Statistics of the link of a LinkController.
+struct LinkStats {
+    uint64_t                 calls;     ///< Number of calls made.
+    uint64_t                 failures;  ///< Number of calls that failed after all retries.
+    uint64_t                 retries;   ///< Number of retries.
+    std::chrono::nanoseconds srtt;      ///< The smoothed round trip of successful calls.
+    std::chrono::nanoseconds rttvar;    ///< The smoothed deviation of the round trip.
+    std::chrono::nanoseconds rto;       ///< The expected upper bound of a round trip, srtt + 4 * rttvar.
+};
+
+/// \brief A Controller that retries failed calls with backoffs adapted to the measured round trips.
+///
+/// Errors with the code Exception::NotFound are never retried.
+class LinkController : public ForwardingController {
+public:
+    /// \brief Opens a controller and wraps it.
+    ///
+    /// \throws Exception
+    static std::shared_ptr<LinkController> open(const std::string& backendID, const std::string& devPath,
+                                                const ControllerOpts& opts, const LinkOpts& linkOpts = LinkOpts()) {
+        return std::make_shared<LinkController>(Controller::open(backendID, devPath, opts), linkOpts);
+    }
+
+    /// \brief Wraps the controller inner.
+    LinkController(Controller::Ptr inner, const LinkOpts& opts = LinkOpts()) : ForwardingController(inner), opts_(opts) {}
+
+    /// \brief Returns the statistics of the link.
+    LinkStats stats() {
+        std::lock_guard<std::mutex> lock(mx_);
+        LinkStats s = stats_;
+        s.rto = rto();
+        return s;
+    }
+
+    std::vector<StepMotor> getStepMotors() override { return call(true, [&] { return inner_->getStepMotors(); }); }
+    StepMotor getStepMotor(const std::string& id) override { return call(true, [&] { return inner_->getStepMotor(id); }); }
+    void setStepMotorRelPos(const std::string& id, int step) override { call(opts_.retryAll, [&] { inner_->setStepMotorRelPos(id, step); }); }
+    void setStepMotorAbsPos(const std::string& id, int step) override { call(true, [&] { inner_->setStepMotorAbsPos(id, step); }); }
+
+    void setStatusLED(StatusLEDState state) override { call(true, [&] { inner_->setStatusLED(state); }); }
+    void setStatusLEDBlinkingDuration(long long int duration) override { call(true, [&] { inner_->setStatusLEDBlinkingDuration(duration); }); }
+
+    std::vector<LED> getLEDs() override { return call(true, [&] { return inner_->getLEDs(); }); }
+    LED getLED(const std::string& id) override { return call(true, [&] { return inner_->getLED(id); }); }
+    void setLED(const std::string& id, bool on) override { call(true, [&] { inner_->setLED(id, on); }); }
+    void setLEDStrobe(const std::string& id, bool on) override { call(true, [&] { inner_->setLEDStrobe(id, on); }); }
+    void setLEDBrightness(const std::string& id, int brightness) override { call(true, [&] { inner_->setLEDBrightness(id, brightness); }); }
+    void setLEDStrobeDelay(const std::string& id, int delay) override { call(true, [&] { inner_->setLEDStrobeDelay(id, delay); }); }
+
+    std::vector<Switch> getSwitches() override { return call(true, [&] { return inner_->getSwitches(); }); }
+    Switch getSwitch(const std::string& id) override { return call(true, [&] { return inner_->getSwitch(id); }); }
+    void setSwitch(const std::string& id, bool on) override { call(true, [&] { inner_->setSwitch(id, on); }); }
+
+    void enableGPIOPins() override { setGPIOPinsEnabled(true); }
+    void disableGPIOPins() override { setGPIOPinsEnabled(false); }
+    std::vector<GPIOPin> getGPIOPins() override { return call(true, [&] { return inner_->getGPIOPins(); }); }
+    GPIOPin getGPIOPin(const std::string& id) override { return call(true, [&] { return inner_->getGPIOPin(id); }); }
+    void setGPIOPin(const std::string& id, bool on) override { call(true, [&] { inner_->setGPIOPin(id, on); }); }
+
+    float temperature() override { return call(true, [&] { return inner_->temperature(); }); }
+    void powerReset() override { call(opts_.retryAll, [&] { inner_->powerReset(); }); }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    // A failed call may still have switched the pins, and switching them again fails.
+    // A retry therefore only repeats the call, if the pins are not yet in the requested state.
+    void setGPIOPinsEnabled(bool enabled) {
+        bool retry = false;
+        call(true, [&] {
+            if (std::exchange(retry, true) && inner_->gpioPinsEnabled() == enabled) {
+                return;
+            }
+            if (enabled) {
+                inner_->enableGPIOPins();
+            } else {
+                inner_->disableGPIOPins();
+            }
+        });
+    }
+
+    template<typename F>
+    std::invoke_result_t<F> call(bool retry, F fn) {
+        Clock::time_point begin = Clock::now();
+        for (int attempt = 0;; ++attempt) {
+            Clock::time_point start = Clock::now();
+            try {
+                if constexpr (std::is_void_v<std::invoke_result_t<F>>) {
+                    fn();
+                    sample(Clock::now() - start, attempt);
+                    return;
+                } else {
+                    auto v = fn();
+                    sample(Clock::now() - start, attempt);
+                    return v;
+                }
+            } catch (Exception& e) {
+                std::chrono::nanoseconds backoff;
+                std::chrono::nanoseconds failed = Clock::now() - start;
+                if (!retry || e.code() == Exception::NotFound || !retryAfter(begin, attempt, failed, backoff)) {
+                    std::lock_guard<std::mutex> lock(mx_);
+                    stats_.calls++;
+                    stats_.failures++;
+                    stats_.retries += attempt;
+                    throw;
+                }
+                std::this_thread::sleep_for(backoff);
+            }
+        }
+    }
+
+    // Decides whether another attempt fits into the budget and how long to back off before it.
+    // failed is the duration of the attempt that just failed.
+    bool retryAfter(Clock::time_point begin, int attempt, std::chrono::nanoseconds failed, std::chrono::nanoseconds& backoff) {
+        if (attempt >= opts_.retries) {
+            return false;
+        }
+        std::chrono::nanoseconds expected;
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            expected = rto();
+        }
+        // Exponential backoff in units of the expected round trip.
+        backoff = std::max<std::chrono::nanoseconds>(expected, opts_.minBackoff) * (1 << attempt);
+        // Failed attempts are not sampled, but the next attempt may take as long, e.g. if it times out again.
+        return Clock::now() - begin + backoff + std::max(expected, failed) <= opts_.budget;
+    }
+
+    // Updates the estimates with the round trip of a successful attempt, as in RFC 6298.
+    void sample(std::chrono::nanoseconds rtt, int attempts) {
+        std::lock_guard<std::mutex> lock(mx_);
+        stats_.calls++;
+        stats_.retries += attempts;
+        if (stats_.srtt.count() == 0) {
+            stats_.srtt = rtt;
+            stats_.rttvar = rtt / 2;
+            return;
+        }
+        std::chrono::nanoseconds dev = rtt > stats_.srtt ? rtt - stats_.srtt : stats_.srtt - rtt;
+        stats_.rttvar += (dev - stats_.rttvar) / 4;
+        stats_.srtt += (rtt - stats_.srtt) / 8;
+    }
+
+    std::chrono::nanoseconds rto() const noexcept {
+        return stats_.srtt + 4 * stats_.rttvar;
+    }
+
+    const LinkOpts opts_;
+    LinkStats      stats_ = {};
+    std::mutex     mx_;
+};
+
+}
+
+#endif
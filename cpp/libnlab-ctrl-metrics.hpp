@@ -0,0 +1,510 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the MetricsController and MetricsServer, that export controller telemetry in the Prometheus text format.
+///
+/// The MetricsController counts every call made through it, records its latency in a histogram per operation
+/// and keeps the last temperature read. Collecting the metrics never calls the controller. \n
+/// Statistics of other wrappers, e.g. reconnects of a SupervisedController, retries of a LinkController or
+/// suppressed writes of a DedupController, are exported with addCounter() and addGauge(). \n
+/// The metrics are rendered on demand with MetricsController::render(), or served over HTTP
+/// on a TCP or Unix domain socket by a MetricsServer.
+#ifndef NLAB_CTRL_LIB_METRICS_HPP
+#define NLAB_CTRL_LIB_METRICS_HPP
+
+#include <string>
+#include <vector>
+#include <array>
+#include <map>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <functional>
+#include <type_traits>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <libnlab-ctrl.hpp>
+#include <libnlab-ctrl-forward.hpp>
+
+namespace nlab::ctrl {
+
+/// \brief A Controller that records metrics of every call made through it.
+class MetricsController : public ForwardingController {
+public:
+    /// \brief Opens a controller and wraps it.
+    ///
+    /// \param[in]  name  The value of the controller label of all metrics. Defaults to backendID.
+    ///
+    /// \throws Exception
+    static std::shared_ptr<MetricsController> open(const std::string& backendID, const std::string& devPath,
+                                                   const ControllerOpts& opts, const std::string& name = std::string()) {
+        return std::make_shared<MetricsController>(Controller::open(backendID, devPath, opts), name.empty() ? backendID : name);
+    }
+
+    /// \brief Wraps the controller inner.
+    ///
+    /// \param[in]  name  The value of the controller label of all metrics.
+    MetricsController(Controller::Ptr inner, const std::string& name) : ForwardingController(inner), name_(name) {}
+
+    /// \brief Exports fn as a counter. fn is called whenever the metrics are rendered.
+    ///
+    /// \param[in]  metric  The name of the metric, e.g. "nlab_ctrl_reconnects_total".
+    /// \param[in]  help    The description of the metric.
+    void addCounter(const std::string& metric, const std::string& help, std::function<double()> fn) {
+        std::lock_guard<std::mutex> lock(mx_);
+        custom_.push_back({metric, help, "counter", fn});
+    }
+
+    /// \brief Exports fn as a gauge. fn is called whenever the metrics are rendered.
+    ///
+    /// \param[in]  metric  The name of the metric, e.g. "nlab_ctrl_link_rtt_seconds".
+    /// \param[in]  help    The description of the metric.
+    void addGauge(const std::string& metric, const std::string& help, std::function<double()> fn) {
+        std::lock_guard<std::mutex> lock(mx_);
+        custom_.push_back({metric, help, "gauge", fn});
+    }
+
+    /// \brief Returns the metrics of this controller in the Prometheus text format.
+    std::string metrics() {
+        return renderAll({this});
+    }
+
+    /// \brief Returns the metrics of several controllers in the Prometheus text format.
+    static std::string render(const std::vector<std::shared_ptr<MetricsController>>& ctrls) {
+        std::vector<MetricsController*> ptrs;
+        for (const auto& c : ctrls) {
+            ptrs.push_back(c.get());
+        }
+        return renderAll(ptrs);
+    }
+
+    std::vector<StepMotor> getStepMotors() override { return call(GetStepMotors, [&] { return inner_->getStepMotors(); }); }
+    StepMotor getStepMotor(const std::string& id) override { return call(GetStepMotor, [&] { return inner_->getStepMotor(id); }); }
+    void setStepMotorRelPos(const std::string& id, int step) override { call(SetStepMotorRelPos, [&] { inner_->setStepMotorRelPos(id, step); }); }
+    void setStepMotorAbsPos(const std::string& id, int step) override { call(SetStepMotorAbsPos, [&] { inner_->setStepMotorAbsPos(id, step); }); }
+
+    void setStatusLED(StatusLEDState state) override { call(SetStatusLED, [&] { inner_->setStatusLED(state); }); }
+    void setStatusLEDBlinkingDuration(long long int duration) override { call(SetStatusLEDBlinkingDuration, [&] { inner_->setStatusLEDBlinkingDuration(duration); }); }
+
+    std::vector<LED> getLEDs() override { return call(GetLEDs, [&] { return inner_->getLEDs(); }); }
+    LED getLED(const std::string& id) override { return call(GetLED, [&] { return inner_->getLED(id); }); }
+    void setLED(const std::string& id, bool on) override { call(SetLED, [&] { inner_->setLED(id, on); }); }
+    void setLEDStrobe(const std::string& id, bool on) override { call(SetLEDStrobe, [&] { inner_->setLEDStrobe(id, on); }); }
+    void setLEDBrightness(const std::string& id, int brightness) override { call(SetLEDBrightness, [&] { inner_->setLEDBrightness(id, brightness); }); }
+    void setLEDStrobeDelay(const std::string& id, int delay) override { call(SetLEDStrobeDelay, [&] { inner_->setLEDStrobeDelay(id, delay); }); }
+
+    std::vector<Switch> getSwitches() override { return call(GetSwitches, [&] { return inner_->getSwitches(); }); }
+    Switch getSwitch(const std::string& id) override { return call(GetSwitch, [&] { return inner_->getSwitch(id); }); }
+    void setSwitch(const std::string& id, bool on) override { call(SetSwitch, [&] { inner_->setSwitch(id, on); }); }
+
+    void enableGPIOPins() override { call(EnableGPIOPins, [&] { inner_->enableGPIOPins(); }); }
+    void disableGPIOPins() override { call(DisableGPIOPins, [&] { inner_->disableGPIOPins(); }); }
+    std::vector<GPIOPin> getGPIOPins() override { return call(GetGPIOPins, [&] { return inner_->getGPIOPins(); }); }
+    GPIOPin getGPIOPin(const std::string& id) override { return call(GetGPIOPin, [&] { return inner_->getGPIOPin(id); }); }
+    void setGPIOPin(const std::string& id, bool on) override { call(SetGPIOPin, [&] { inner_->setGPIOPin(id, on); }); }
+
+    float temperature() override {
+        float t = call(Temperature, [&] { return inner_->temperature(); });
+        temperature_.store(t, std::memory_order_relaxed);
+        hasTemperature_.store(true, std::memory_order_release);
+        return t;
+    }
+    void powerReset() override { call(PowerReset, [&] { inner_->powerReset(); }); }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    enum Op {
+        GetStepMotors, GetStepMotor, SetStepMotorRelPos, SetStepMotorAbsPos,
+        SetStatusLED, SetStatusLEDBlinkingDuration,
+        GetLEDs, GetLED, SetLED, SetLEDStrobe, SetLEDBrightness, SetLEDStrobeDelay,
+        GetSwitches, GetSwitch, SetSwitch,
+        EnableGPIOPins, DisableGPIOPins, GetGPIOPins, GetGPIOPin, SetGPIOPin,
+        Temperature, PowerReset,
+        NumOps
+    };
+
+    static const char* opName(int op) {
+        static const char* names[NumOps] = {
+            "getStepMotors", "getStepMotor", "setStepMotorRelPos", "setStepMotorAbsPos",
+            "setStatusLED", "setStatusLEDBlinkingDuration",
+            "getLEDs", "getLED", "setLED", "setLEDStrobe", "setLEDBrightness", "setLEDStrobeDelay",
+            "getSwitches", "getSwitch", "setSwitch",
+            "enableGPIOPins", "disableGPIOPins", "getGPIOPins", "getGPIOPin", "setGPIOPin",
+            "temperature", "powerReset"
+        };
+        return names[op];
+    }
+
+    // The upper bounds of the latency buckets in seconds.
+    static constexpr std::array<double, 14> Buckets = {
+        0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5
+    };
+
+    struct OpMetrics {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> errors{0};
+        std::atomic<uint64_t> sumNs{0};
+        std::array<std::atomic<uint64_t>, Buckets.size()> buckets{};
+    };
+
+    struct Custom {
+        std::string             metric;
+        std::string             help;
+        std::string             type;
+        std::function<double()> fn;
+    };
+
+    template<typename F>
+    std::invoke_result_t<F> call(Op op, F fn) {
+        Clock::time_point start = Clock::now();
+        try {
+            if constexpr (std::is_void_v<std::invoke_result_t<F>>) {
+                fn();
+                record(op, Clock::now() - start, false);
+            } else {
+                auto v = fn();
+                record(op, Clock::now() - start, false);
+                return v;
+            }
+        } catch (...) {
+            record(op, Clock::now() - start, true);
+            throw;
+        }
+    }
+
+    void record(Op op, std::chrono::nanoseconds d, bool failed) noexcept {
+        OpMetrics& m = ops_[op];
+        m.calls.fetch_add(1, std::memory_order_relaxed);
+        if (failed) {
+            m.errors.fetch_add(1, std::memory_order_relaxed);
+        }
+        m.sumNs.fetch_add(d.count(), std::memory_order_relaxed);
+        double s = std::chrono::duration<double>(d).count();
+        for (size_t i = 0; i < Buckets.size(); ++i) {
+            if (s <= Buckets[i]) {
+                m.buckets[i].fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+        }
+    }
+
+    static std::string escape(const std::string& s) {
+        std::string out;
+        for (char c : s) {
+            if (c == '\\' || c == '"') {
+                out += '\\';
+                out += c;
+            } else if (c == '\n') {
+                out += "\\n";
+            } else {
+                out += c;
+            }
+        }
+        return out;
+    }
+
+    static void header(std::ostream& out, const std::string& metric, const std::string& help, const std::string& type) {
+        out << "# HELP " << metric << " " << help << "\n# TYPE " << metric << " " << type << "\n";
+    }
+
+    // Renders every metric family once, with a sample per controller.
+    static std::string renderAll(const std::vector<MetricsController*>& ctrls) {
+        std::ostringstream out;
+
+        header(out, "nlab_ctrl_calls_total", "Number of controller calls.", "counter");
+        for (MetricsController* c : ctrls) {
+            c->each([&](const std::string& l, const OpMetrics& m) {
+                out << "nlab_ctrl_calls_total{" << l << "} " << m.calls.load(std::memory_order_relaxed) << "\n";
+            });
+        }
+        header(out, "nlab_ctrl_errors_total", "Number of failed controller calls.", "counter");
+        for (MetricsController* c : ctrls) {
+            c->each([&](const std::string& l, const OpMetrics& m) {
+                out << "nlab_ctrl_errors_total{" << l << "} " << m.errors.load(std::memory_order_relaxed) << "\n";
+            });
+        }
+        header(out, "nlab_ctrl_call_duration_seconds", "Latency of controller calls.", "histogram");
+        for (MetricsController* c : ctrls) {
+            c->each([&](const std::string& l, const OpMetrics& m) {
+                uint64_t cum = 0;
+                for (size_t i = 0; i < Buckets.size(); ++i) {
+                    cum += m.buckets[i].load(std::memory_order_relaxed);
+                    out << "nlab_ctrl_call_duration_seconds_bucket{" << l << ",le=\"" << Buckets[i] << "\"} " << cum << "\n";
+                }
+                uint64_t calls = m.calls.load(std::memory_order_relaxed);
+                out << "nlab_ctrl_call_duration_seconds_bucket{" << l << ",le=\"+Inf\"} " << calls << "\n";
+                out << "nlab_ctrl_call_duration_seconds_sum{" << l << "} " << m.sumNs.load(std::memory_order_relaxed) / 1e9 << "\n";
+                out << "nlab_ctrl_call_duration_seconds_count{" << l << "} " << calls << "\n";
+            });
+        }
+
+        header(out, "nlab_ctrl_temperature_celsius", "The last temperature read from the controller.", "gauge");
+        for (MetricsController* c : ctrls) {
+            if (c->hasTemperature_.load(std::memory_order_acquire)) {
+                out << "nlab_ctrl_temperature_celsius{controller=\"" << escape(c->name_) << "\"} "
+                    << c->temperature_.load(std::memory_order_relaxed) << "\n";
+            }
+        }
+
+        // Custom metrics, grouped by name. The functions are called without holding a lock.
+        std::map<std::string, std::vector<std::pair<MetricsController*, Custom>>> families;
+        for (MetricsController* c : ctrls) {
+            std::lock_guard<std::mutex> lock(c->mx_);
+            for (const Custom& m : c->custom_) {
+                families[m.metric].emplace_back(c, m);
+            }
+        }
+        for (const auto& [metric, samples] : families) {
+            header(out, metric, samples.front().second.help, samples.front().second.type);
+            for (const auto& [c, m] : samples) {
+                out << metric << "{controller=\"" << escape(c->name_) << "\"} " << m.fn() << "\n";
+            }
+        }
+        return out.str();
+    }
+
+    // Calls fn for every operation called at least once, with its labels.
+    template<typename F>
+    void each(F fn) const {
+        std::string controller = "controller=\"" + escape(name_) + "\",op=\"";
+        for (int op = 0; op < NumOps; ++op) {
+            if (ops_[op].calls.load(std::memory_order_relaxed) > 0) {
+                fn(controller + opName(op) + "\"", ops_[op]);
+            }
+        }
+    }
+
+    const std::string              name_;
+    std::array<OpMetrics, NumOps>  ops_;
+    std::atomic<float>             temperature_{0};
+    std::atomic<bool>              hasTemperature_{false};
+    std::vector<Custom>            custom_;
+    std::mutex                     mx_;
+};
+
+/// \brief Serves metrics over HTTP on its own thread.
+///
+/// Every request is answered with the current metrics, regardless of its path.
+class MetricsServer {
+public:
+    /// \brief Creates the text of the response body.
+    typedef std::function<std::string()> RenderFunc;
+
+    /// \brief Starts serving.
+    ///
+    /// \param[in]  address  A Unix domain socket path starting with '/', or "<ipv4>:<port>", e.g. "127.0.0.1:9100".
+    /// \param[in]  render   Returns the metrics, e.g. MetricsController::metrics().
+    ///
+    /// A stale socket file at a Unix domain socket path is removed. It fails, if another server listens on the path.
+    ///
+    /// \throws Exception  If the socket could not be created.
+    MetricsServer(const std::string& address, RenderFunc render) : address_(address), render_(render) {
+        if (::pipe2(wake_, O_CLOEXEC | O_NONBLOCK) != 0) {
+            throw Exception(Exception::Generic, "metrics: pipe: " + std::string(std::strerror(errno)));
+        }
+        if (!listen()) {
+            std::string msg = "metrics: listen on " + address_ + ": " + std::strerror(errno);
+            closeFds();
+            throw Exception(Exception::Generic, msg);
+        }
+        worker_ = std::thread([this] { run(); });
+    }
+
+    /// \brief Stops serving.
+    ~MetricsServer() {
+        char b = 0;
+        (void)!::write(wake_[1], &b, 1);
+        worker_.join();
+        closeFds();
+        if (!address_.empty() && address_[0] == '/') {
+            ::unlink(address_.c_str());
+        }
+    }
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    // Maximum time to read a request and send the response.
+    static constexpr std::chrono::milliseconds ExchangeTimeout = std::chrono::milliseconds(2000);
+
+    bool listen() {
+        if (!address_.empty() && address_[0] == '/') {
+            sockaddr_un addr = {};
+            addr.sun_family = AF_UNIX;
+            if (address_.size() >= sizeof(addr.sun_path)) {
+                errno = ENAMETOOLONG;
+                return false;
+            }
+            std::strncpy(addr.sun_path, address_.c_str(), sizeof(addr.sun_path) - 1);
+            // Only replace a stale socket, never another file or the socket of a running server.
+            struct stat st;
+            if (::lstat(address_.c_str(), &st) == 0) {
+                if (!S_ISSOCK(st.st_mode)) {
+                    errno = EEXIST;
+                    return false;
+                }
+                if (listening(addr)) {
+                    errno = EADDRINUSE;
+                    return false;
+                }
+                ::unlink(address_.c_str());
+            }
+            lfd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (lfd_ < 0) {
+                return false;
+            }
+            return ::bind(lfd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 && ::listen(lfd_, 16) == 0;
+        }
+
+        size_t n = address_.rfind(':');
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        if (n == std::string::npos || ::inet_pton(AF_INET, address_.substr(0, n).c_str(), &addr.sin_addr) != 1) {
+            errno = EINVAL;
+            return false;
+        }
+        const char* port = address_.c_str() + n + 1;
+        char* end = nullptr;
+        errno = 0;
+        long p = std::strtol(port, &end, 10);
+        if (*port < '0' || *port > '9' || *end != '\0' || errno != 0 || p < 1 || p > 65535) {
+            errno = EINVAL;
+            return false;
+        }
+        addr.sin_port = htons(static_cast<uint16_t>(p));
+        lfd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (lfd_ < 0) {
+            return false;
+        }
+        int one = 1;
+        ::setsockopt(lfd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        return ::bind(lfd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 && ::listen(lfd_, 16) == 0;
+    }
+
+    static bool listening(const sockaddr_un& addr) {
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (fd < 0) {
+            return false;
+        }
+        // A full backlog fails with EAGAIN, but the server is still running.
+        bool ok = ::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0 || errno == EAGAIN;
+        ::close(fd);
+        return ok;
+    }
+
+    void run() {
+        for (;;) {
+            pollfd pfds[2] = {{wake_[0], POLLIN, 0}, {lfd_, POLLIN, 0}};
+            if (::poll(pfds, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            if (pfds[0].revents & POLLIN) {
+                return;
+            }
+            if (pfds[1].revents & POLLIN) {
+                int fd = ::accept4(lfd_, nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd >= 0) {
+                    serve(fd);
+                    ::close(fd);
+                }
+            }
+        }
+    }
+
+    // Reads the request header, bounded in size, and answers it.
+    // The whole exchange must finish within ExchangeTimeout, so that a slow client cannot stall the server.
+    void serve(int fd) {
+        Clock::time_point deadline = Clock::now() + ExchangeTimeout;
+        std::string req;
+        char buf[1024];
+        while (req.find("\r\n\r\n") == std::string::npos && req.size() < 8192) {
+            if (!waitFor(fd, POLLIN, deadline)) {
+                return;
+            }
+            ssize_t n = ::read(fd, buf, sizeof(buf));
+            if (n <= 0) {
+                return;
+            }
+            req.append(buf, n);
+        }
+
+        std::string body = render_();
+        std::string resp = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                           std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        size_t off = 0;
+        while (off < resp.size()) {
+            if (!waitFor(fd, POLLOUT, deadline)) {
+                return;
+            }
+            ssize_t n = ::send(fd, resp.data() + off, resp.size() - off, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                continue;
+            }
+            if (n <= 0) {
+                return;
+            }
+            off += n;
+        }
+    }
+
+    // Waits until fd is ready for events. Returns false on errors and once the deadline passed.
+    static bool waitFor(int fd, short events, Clock::time_point deadline) {
+        for (;;) {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - Clock::now());
+            if (left.count() <= 0) {
+                return false;
+            }
+            pollfd pfd = {fd, events, 0};
+            int r = ::poll(&pfd, 1, static_cast<int>(left.count()));
+            if (r < 0 && errno == EINTR) {
+                continue;
+            }
+            return r > 0 && (pfd.revents & events);
+        }
+    }
+
+    void closeFds() {
+        if (lfd_ >= 0) {
+            ::close(lfd_);
+        }
+        ::close(wake_[0]);
+        ::close(wake_[1]);
+    }
+
+    const std::string address_;
+    RenderFunc        render_;
+    int               lfd_ = -1;
+    int               wake_[2] = {-1, -1};
+    std::thread       worker_;
+};
+
+}
+
+#endif
@@ -0,0 +1,401 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the MotionPlanner, that merges step motor targets and shapes their velocity.
+///
+/// Controller::setStepMotorRelPos() sends every step delta as its own command and motion.
+/// The MotionPlanner instead accepts absolute targets, of which only the latest one per motor matters.
+/// A worker thread moves each motor towards its current target, following a trapezoidal or S-curve
+/// velocity profile, and predicts when the motor comes to rest.
+#ifndef NLAB_CTRL_LIB_MOTION_HPP
+#define NLAB_CTRL_LIB_MOTION_HPP
+
+#include <string>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
+#include <cmath>
+#include <algorithm>
+
+#include <libnlab-ctrl.hpp>
+
+namespace nlab::ctrl {
+
+/// \brief The velocity profile of a MotionPlanner.
+enum MotionProfile {
+    Trapezoidal = 0, ///< Constant acceleration up to the maximum velocity and constant deceleration.
+    SCurve      = 1  ///< Like Trapezoidal, but the acceleration itself ramps with a limited jerk.
+};
+
+/// \brief Options for a MotionPlanner.
+///
+/// The limits describe the motor and its load. \n
+/// For every member that is not set a sensible default value is used. This means that an empty struct represents default options.
+struct MotionOpts {
+    /// \brief The velocity profile. Defaults to MotionProfile::Trapezoidal.
+    MotionProfile profile = Trapezoidal;
+
+    /// \brief Maximum velocity in steps per second. Defaults to 1000.
+    double maxVelocity = 1000;
+
+    /// \brief Maximum acceleration in steps per second². Defaults to 5000.
+    double acceleration = 5000;
+
+    /// \brief Maximum jerk in steps per second³ of MotionProfile::SCurve. Defaults to 50000.
+    double jerk = 50000;
+
+    /// \brief Period of the segments a move is split into. Defaults to 0.
+    ///
+    /// If 0, every move is sent as a single command, once the previous one finished. The motor then runs
+    /// its own profile, which the options only model to predict the completion time. \n
+    /// Otherwise, a segment covering the distance of the profile in this period is sent every period.
+    /// A new target then takes effect at the next segment, continuing from the current velocity.
+    std::chrono::milliseconds segment = std::chrono::milliseconds(0);
+};
+
+/// \brief Counters of a MotionPlanner.
+struct MotionStats {
+    long long int requests; ///< Number of targets requested.
+    long long int merged;   ///< Number of targets replaced by a newer one, before being reached.
+    long long int commands; ///< Number of commands sent to the controller.
+};
+
+/// \brief Moves step motors to absolute targets on a worker thread.
+///
+/// All methods may be called from any thread.
+class MotionPlanner {
+public:
+    /// \brief Creates a planner for the controller and starts its worker thread.
+    ///
+    /// \param[in]  ctrl  The controller.
+    /// \param[in]  opts  Optional parameters of the planner.
+    MotionPlanner(Controller::Ptr ctrl, const MotionOpts& opts = MotionOpts())
+        : ctrl_(ctrl), opts_(opts) {
+        worker_ = std::thread([this] { run(); });
+    }
+
+    /// \brief Stops the worker thread. Moves in progress are not completed.
+    ~MotionPlanner() {
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            stopped_ = true;
+        }
+        cv_.notify_all();
+        worker_.join();
+    }
+
+    MotionPlanner(const MotionPlanner&) = delete;
+    MotionPlanner& operator=(const MotionPlanner&) = delete;
+
+    /// \brief Sets the target of a step motor.
+    ///
+    /// Replaces any target that has not been reached yet.
+    /// The target is clamped to StepMotor::minStep and StepMotor::maxStep.
+    ///
+    /// \param[in]  id    The id of the step motor.
+    /// \param[in]  step  The absolute target position.
+    ///
+    /// \throws Exception
+    void moveTo(const std::string& id, int step) {
+        std::unique_lock<std::mutex> lock(mx_);
+        Axis& a = axis(id, lock);
+        retarget(a, step);
+    }
+
+    /// \brief Moves the target of a step motor by the given step.
+    ///
+    /// The step is relative to the current target, not the current position.
+    ///
+    /// \param[in]  id    The id of the step motor.
+    /// \param[in]  step  Number of steps to move the target.
+    ///
+    /// \throws Exception
+    void moveBy(const std::string& id, int step) {
+        std::unique_lock<std::mutex> lock(mx_);
+        Axis& a = axis(id, lock);
+        retarget(a, a.target + step);
+    }
+
+    /// \brief Returns the current target of a step motor.
+    ///
+    /// \throws Exception
+    int target(const std::string& id) {
+        std::unique_lock<std::mutex> lock(mx_);
+        return axis(id, lock).target;
+    }
+
+    /// \brief Returns the position of a step motor, as commanded so far.
+    ///
+    /// \throws Exception
+    int position(const std::string& id) {
+        std::unique_lock<std::mutex> lock(mx_);
+        return axis(id, lock).sent;
+    }
+
+    /// \brief Returns the time at which the step motor is expected to reach its target and come to rest.
+    ///
+    /// \throws Exception
+    std::chrono::steady_clock::time_point estimatedCompletion(const std::string& id) {
+        std::unique_lock<std::mutex> lock(mx_);
+        return completion(axis(id, lock), std::chrono::steady_clock::now());
+    }
+
+    /// \brief Blocks until the step motor reached its target and came to rest.
+    ///
+    /// \throws Exception  If a command of the motor failed since the last call.
+    void wait(const std::string& id) {
+        std::unique_lock<std::mutex> lock(mx_);
+        Axis& a = axis(id, lock);
+        cv_.wait(lock, [&] { return stopped_ || a.err || (a.sent == a.target && a.v == 0 && !a.inFlight); });
+        if (a.err) {
+            std::exception_ptr err = a.err;
+            a.err = nullptr;
+            std::rethrow_exception(err);
+        }
+        auto done = completion(a, std::chrono::steady_clock::now());
+        lock.unlock();
+        std::this_thread::sleep_until(done);
+    }
+
+    /// \brief Returns the counters of the planner.
+    MotionStats stats() {
+        std::lock_guard<std::mutex> lock(mx_);
+        return stats_;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Axis {
+        int               minStep;
+        int               maxStep;
+        int               target;
+        int               sent;          // Position commanded to the controller.
+        double            x;             // Position along the profile.
+        double            v   = 0;       // Velocity along the profile.
+        double            acc = 0;       // Acceleration along the profile.
+        bool              reached = true;
+        bool              inFlight = false; // A command is being sent without holding the lock.
+        Clock::time_point busyUntil;     // End of the last single command move.
+        std::exception_ptr err;
+    };
+
+    Axis& axis(const std::string& id, std::unique_lock<std::mutex>& lock) {
+        auto it = axes_.find(id);
+        if (it != axes_.end()) {
+            return it->second;
+        }
+
+        // Read the limits and position without holding the lock.
+        lock.unlock();
+        StepMotor sm = ctrl_->getStepMotor(id);
+        lock.lock();
+
+        Axis a;
+        a.minStep = sm.minStep;
+        a.maxStep = sm.maxStep;
+        a.target  = sm.step;
+        a.sent    = sm.step;
+        a.x       = sm.step;
+        return axes_.emplace(id, a).first->second;
+    }
+
+    void retarget(Axis& a, int step) {
+        step = std::clamp(step, a.minStep, a.maxStep);
+        stats_.requests++;
+        if (!a.reached) {
+            stats_.merged++;
+        }
+        a.target = step;
+        a.reached = a.sent == a.target && a.v == 0;
+        cv_.notify_all();
+    }
+
+    // Returns the time at which the axis is expected to come to rest.
+    Clock::time_point completion(const Axis& a, Clock::time_point now) const {
+        if (opts_.segment.count() == 0) {
+            auto t = std::max(now, a.busyUntil);
+            if (a.sent != a.target) {
+                t += duration(a.target - a.sent);
+            }
+            return t;
+        }
+
+        Axis s = a;
+        double dt = seconds(opts_.segment);
+        auto t = now;
+        while (!step(s, dt)) {
+            t += opts_.segment;
+        }
+        return t;
+    }
+
+    // Returns the duration of a move from rest to rest, following the profile.
+    Clock::duration duration(int distance) const {
+        double d    = std::abs(static_cast<double>(distance));
+        double vmax = std::max(1.0, opts_.maxVelocity);
+        double amax = std::max(1.0, opts_.acceleration);
+        double t;
+        if (opts_.profile == SCurve) {
+            double j = std::max(1.0, opts_.jerk);
+            // Time to accelerate from rest to v. The full acceleration is only reached above amax²/j.
+            auto ramp = [&](double v) { return v >= amax * amax / j ? v / amax + amax / j : 2 * std::sqrt(v / j); };
+            if (d >= vmax * ramp(vmax)) {
+                t = 2 * ramp(vmax) + (d - vmax * ramp(vmax)) / vmax;
+            } else {
+                // The peak velocity vp of a move without cruise, that solves vp * ramp(vp) = d.
+                double vp = (-amax * amax / j + std::sqrt(std::pow(amax, 4) / (j * j) + 4 * amax * d)) / 2;
+                if (vp < amax * amax / j) {
+                    vp = std::cbrt(d * d * j / 4);
+                }
+                t = 2 * ramp(vp);
+            }
+        } else if (d >= vmax * vmax / amax) {
+            t = d / vmax + vmax / amax;
+        } else {
+            t = 2 * std::sqrt(d / amax);
+        }
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(t));
+    }
+
+    // Advances the axis by dt along the profile towards its target.
+    // Returns true, once the axis came to rest at its target.
+    bool step(Axis& s, double dt) const {
+        double d = s.target - s.x;
+        if (d == 0 && s.v == 0) {
+            return true;
+        }
+
+        double vmax = std::max(1.0, opts_.maxVelocity);
+        double amax = std::max(1.0, opts_.acceleration);
+        double dir  = d < 0 ? -1 : 1;
+
+        // The velocity, from which the axis can still stop at the target.
+        double stop = std::abs(d);
+        if (opts_.profile == SCurve) {
+            // Leave room for the acceleration to ramp down to the full deceleration.
+            stop = std::max(0.0, stop - 2 * std::abs(s.v) * amax / std::max(1.0, opts_.jerk));
+        }
+        double vd = dir * std::min(vmax, std::sqrt(2 * amax * stop));
+
+        double ad = std::clamp((vd - s.v) / dt, -amax, amax);
+        if (opts_.profile == SCurve) {
+            double dj = std::max(1.0, opts_.jerk) * dt;
+            s.acc += std::clamp(ad - s.acc, -dj, dj);
+        } else {
+            s.acc = ad;
+        }
+        s.v += s.acc * dt;
+        s.x += s.v * dt;
+
+        // Snap onto the target instead of overshooting it.
+        double rest = s.target - s.x;
+        if (rest * dir <= 0 || (std::abs(rest) < 0.5 && std::abs(s.v) * dt < 1)) {
+            s.x = s.target;
+            s.v = 0;
+            s.acc = 0;
+        }
+        s.sent = static_cast<int>(std::lround(s.x));
+        return s.x == s.target && s.v == 0;
+    }
+
+    static double seconds(Clock::duration d) {
+        return std::chrono::duration<double>(d).count();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mx_);
+        for (;;) {
+            if (stopped_) {
+                return;
+            }
+
+            auto now = Clock::now();
+            auto next = Clock::time_point::max();
+            for (auto& [id, a] : axes_) {
+                if (a.sent == a.target && a.v == 0) {
+                    continue;
+                }
+
+                int from = a.sent;
+                if (opts_.segment.count() == 0) {
+                    if (now < a.busyUntil) {
+                        next = std::min(next, a.busyUntil);
+                        continue;
+                    }
+                    a.busyUntil = now + duration(a.target - from);
+                    a.sent = a.target;
+                    a.x = a.target;
+                } else {
+                    step(a, seconds(opts_.segment));
+                    next = std::min(next, now + opts_.segment);
+                }
+
+                if (a.sent != from && !send(id, a, a.sent - from, lock)) {
+                    continue;
+                }
+                if (a.sent == a.target && a.v == 0) {
+                    a.reached = true;
+                    cv_.notify_all();
+                }
+            }
+
+            if (next == Clock::time_point::max()) {
+                cv_.wait(lock);
+            } else {
+                cv_.wait_until(lock, next);
+            }
+        }
+    }
+
+    // Sends the move without holding the lock. The axis entry stays valid, as axes are never removed.
+    bool send(const std::string& id, Axis& a, int delta, std::unique_lock<std::mutex>& lock) {
+        stats_.commands++;
+        a.inFlight = true;
+        lock.unlock();
+        std::exception_ptr err;
+        try {
+            ctrl_->setStepMotorRelPos(id, delta);
+        } catch (...) {
+            err = std::current_exception();
+        }
+        lock.lock();
+        a.inFlight = false;
+        cv_.notify_all();
+
+        if (err) {
+            // Resync with the controller on the next target.
+            a.sent -= delta;
+            a.x = a.sent;
+            a.v = 0;
+            a.acc = 0;
+            a.target = a.sent;
+            a.reached = true;
+            a.err = err;
+            cv_.notify_all();
+            return false;
+        }
+        return true;
+    }
+
+    Controller::Ptr         ctrl_;
+    const MotionOpts        opts_;
+    std::map<std::string, Axis> axes_;
+    MotionStats             stats_ = {};
+    bool                    stopped_ = false;
+    std::mutex              mx_;
+    std::condition_variable cv_;
+    std::thread             worker_;
+};
+
+}
+
+#endif
@@ -0,0 +1,286 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the ChangeNotifier, that reports changes of step motors, leds, switches and gpio pins.
+///
+/// Instead of every consumer polling every resource, a single worker thread reads all resource lists
+/// of the controller in a fixed interval, compares them to the last known state and reports the differences
+/// to registered observers. Changes are coalesced per resource to a maximum notification rate. \n
+/// Changes can be received by callbacks on the worker thread, or from a queue signalled through a
+/// pollable file descriptor, that integrates into event loops.
+#ifndef NLAB_CTRL_LIB_NOTIFY_HPP
+#define NLAB_CTRL_LIB_NOTIFY_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <variant>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <libnlab-ctrl.hpp>
+
+namespace nlab::ctrl {
+
+/// \brief A change of a single resource.
+template<typename T>
+struct Change {
+    T                                     old;  ///< The value reported with the previous notification.
+    T                                     now;  ///< The current value.
+    std::chrono::steady_clock::time_point time; ///< The time the current value was read.
+};
+
+/// \brief Any change delivered through the queue of a ChangeNotifier.
+typedef std::variant<Change<StepMotor>, Change<LED>, Change<Switch>, Change<GPIOPin>> AnyChange;
+
+/// \brief Options for a ChangeNotifier.
+///
+/// For every member that is not set a sensible default value is used. This means that an empty struct represents default options.
+struct NotifierOpts {
+    /// \brief Interval in which the resources are read. Defaults to 50 milliseconds.
+    std::chrono::milliseconds interval = std::chrono::milliseconds(50);
+
+    /// \brief Minimum time between two notifications of the same resource. Defaults to 0.
+    ///
+    /// Changes within this time are coalesced into a single notification with the latest value.
+    std::chrono::milliseconds minPeriod = std::chrono::milliseconds(0);
+
+    /// \brief Delivers all changes to the queue read by ChangeNotifier::poll(). Defaults to false.
+    bool queue = false;
+
+    /// \brief Maximum number of changes in the queue. The oldest changes are dropped first. Defaults to 1024.
+    size_t queueSize = 1024;
+};
+
+/// \brief Reports changes of the resources of a controller.
+///
+/// All methods may be called from any thread, but observers must not be added or removed from within an observer.
+/// Observers are called on the worker thread, exceptions they throw are dropped.
+class ChangeNotifier {
+public:
+    /// \brief Identifies a registered observer.
+    typedef uint64_t ObserverID;
+
+    /// \brief Creates a notifier for the controller and starts its worker thread.
+    ///
+    /// The first read establishes the initial state and reports no changes.
+    ///
+    /// \throws Exception  If the eventfd could not be created.
+    ChangeNotifier(Controller::Ptr ctrl, const NotifierOpts& opts = NotifierOpts()) : ctrl_(ctrl), opts_(opts) {
+        fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd_ < 0) {
+            throw Exception(Exception::Generic, "notifier: failed to create eventfd");
+        }
+        worker_ = std::thread([this] { run(); });
+    }
+
+    /// \brief Stops the worker thread and closes the file descriptor.
+    ~ChangeNotifier() {
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            stopped_ = true;
+        }
+        cv_.notify_all();
+        worker_.join();
+        ::close(fd_);
+    }
+
+    ChangeNotifier(const ChangeNotifier&) = delete;
+    ChangeNotifier& operator=(const ChangeNotifier&) = delete;
+
+    /// \brief Observes a step motor, or all step motors, if id is empty.
+    ObserverID observeStepMotor(const std::string& id, std::function<void(const Change<StepMotor>&)> fn) { return add(stepMotors_, id, fn); }
+    /// \brief Observes a led, or all leds, if id is empty.
+    ObserverID observeLED(const std::string& id, std::function<void(const Change<LED>&)> fn) { return add(leds_, id, fn); }
+    /// \brief Observes a switch, or all switches, if id is empty.
+    ObserverID observeSwitch(const std::string& id, std::function<void(const Change<Switch>&)> fn) { return add(switches_, id, fn); }
+    /// \brief Observes a gpio pin, or all gpio pins, if id is empty.
+    ObserverID observeGPIOPin(const std::string& id, std::function<void(const Change<GPIOPin>&)> fn) { return add(gpioPins_, id, fn); }
+
+    /// \brief Removes an observer.
+    void unobserve(ObserverID id) {
+        std::lock_guard<std::mutex> lock(mx_);
+        stepMotors_.observers.erase(id);
+        leds_.observers.erase(id);
+        switches_.observers.erase(id);
+        gpioPins_.observers.erase(id);
+    }
+
+    /// \brief Returns a file descriptor, that becomes readable when the queue holds changes.
+    ///
+    /// Only signalled if NotifierOpts::queue is set. Do not read from or close it, use poll() instead.
+    int fd() const noexcept { return fd_; }
+
+    /// \brief Retrieves the oldest change from the queue.
+    ///
+    /// \param[out]  c  The change.
+    ///
+    /// \return False, if the queue is empty.
+    bool poll(AnyChange& c) {
+        std::lock_guard<std::mutex> lock(mx_);
+        if (queue_.empty()) {
+            uint64_t v;
+            ssize_t r = ::read(fd_, &v, sizeof(v));
+            (void)r;
+            return false;
+        }
+        c = std::move(queue_.front());
+        queue_.pop_front();
+        return true;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    template<typename T>
+    struct Tracked {
+        T                 notified;    // The value reported last.
+        T                 current;     // The value read last.
+        Clock::time_point time;        // The time current was read.
+        Clock::time_point lastNotify;
+    };
+
+    template<typename T>
+    struct Resource {
+        std::map<std::string, Tracked<T>> tracked;
+        std::map<ObserverID, std::pair<std::string, std::function<void(const Change<T>&)>>> observers;
+    };
+
+    template<typename T, typename F>
+    ObserverID add(Resource<T>& r, const std::string& id, F fn) {
+        std::lock_guard<std::mutex> lock(mx_);
+        ObserverID oid = nextID_++;
+        r.observers[oid] = {id, fn};
+        return oid;
+    }
+
+    static bool equal(const StepMotor& a, const StepMotor& b) {
+        return a.step == b.step && a.minStep == b.minStep && a.maxStep == b.maxStep && a.name == b.name;
+    }
+    static bool equal(const LED& a, const LED& b) {
+        return a.on == b.on && a.brightness == b.brightness && a.strobeOn == b.strobeOn && a.strobeDelay == b.strobeDelay && a.name == b.name;
+    }
+    static bool equal(const Switch& a, const Switch& b) {
+        return a.on == b.on && a.name == b.name;
+    }
+    static bool equal(const GPIOPin& a, const GPIOPin& b) {
+        return a.on == b.on && a.direction == b.direction && a.name == b.name;
+    }
+
+    void run() {
+        auto next = Clock::now();
+        std::unique_lock<std::mutex> lock(mx_);
+        while (!stopped_) {
+            lock.unlock();
+            // Resources that cannot be read, e.g. gpio pins while disabled, are skipped this round.
+            read(stepMotors_, [this] { return ctrl_->getStepMotors(); });
+            read(leds_, [this] { return ctrl_->getLEDs(); });
+            read(switches_, [this] { return ctrl_->getSwitches(); });
+            if (ctrl_->gpioPinsEnabled()) {
+                read(gpioPins_, [this] { return ctrl_->getGPIOPins(); });
+            }
+            lock.lock();
+
+            next += opts_.interval;
+            auto now = Clock::now();
+            if (next < now) {
+                next = now;
+            }
+            cv_.wait_until(lock, next, [this] { return stopped_; });
+        }
+    }
+
+    template<typename T, typename F>
+    void read(Resource<T>& r, F list) {
+        std::vector<T> values;
+        try {
+            values = list();
+        } catch (Exception&) {
+            return;
+        }
+        Clock::time_point now = Clock::now();
+
+        std::vector<Change<T>> changes;
+        std::vector<std::pair<std::function<void(const Change<T>&)>, size_t>> calls;
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            for (const T& v : values) {
+                auto it = r.tracked.find(v.id);
+                if (it == r.tracked.end()) {
+                    r.tracked[v.id] = Tracked<T>{v, v, now, now};
+                    continue;
+                }
+                Tracked<T>& t = it->second;
+                t.current = v;
+                t.time = now;
+                if (equal(t.notified, t.current) || now - t.lastNotify < opts_.minPeriod) {
+                    // Unchanged, or coalesced until the period elapsed.
+                    continue;
+                }
+                changes.push_back(Change<T>{t.notified, t.current, t.time});
+                t.notified = t.current;
+                t.lastNotify = now;
+            }
+
+            for (const Change<T>& c : changes) {
+                if (opts_.queue) {
+                    if (queue_.size() >= opts_.queueSize) {
+                        queue_.pop_front();
+                    }
+                    queue_.push_back(c);
+                }
+            }
+            if (opts_.queue && !changes.empty()) {
+                uint64_t one = 1;
+                ssize_t w = ::write(fd_, &one, sizeof(one));
+                (void)w;
+            }
+            for (size_t i = 0; i < changes.size(); ++i) {
+                for (const auto& [oid, o] : r.observers) {
+                    if (o.first.empty() || o.first == changes[i].now.id) {
+                        calls.emplace_back(o.second, i);
+                    }
+                }
+            }
+        }
+
+        // Call the observers without holding the lock. A throwing observer must not end the worker thread.
+        for (const auto& [fn, i] : calls) {
+            try {
+                fn(changes[i]);
+            } catch (...) {
+            }
+        }
+    }
+
+    Controller::Ptr         ctrl_;
+    const NotifierOpts      opts_;
+    int                     fd_ = -1;
+    Resource<StepMotor>     stepMotors_;
+    Resource<LED>           leds_;
+    Resource<Switch>        switches_;
+    Resource<GPIOPin>       gpioPins_;
+    std::deque<AnyChange>   queue_;
+    ObserverID              nextID_  = 1;
+    bool                    stopped_ = false;
+    std::mutex              mx_;
+    std::condition_variable cv_;
+    std::thread             worker_;
+};
+
+}
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the ControllerPool, that shares one session per controller within a process.
+///
+/// Opening the same device twice fails or lets both sessions compete for the serial port.
+/// ControllerPool::open() takes the same arguments as Controller::open(), but returns the session
+/// already opened for the backend and device path, if there is one. The session is closed
+/// when the last Controller::Ptr to it is released.
+#ifndef NLAB_CTRL_LIB_POOL_HPP
+#define NLAB_CTRL_LIB_POOL_HPP
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+
+#include <libnlab-ctrl.hpp>
+#include <libnlab-ctrl-forward.hpp>
+
+namespace nlab::ctrl {
+
+/// \brief A process-wide registry of open controllers.
+///
+/// All methods may be called from any thread.
+class ControllerPool {
+public:
+    /// \brief Returns the session for the controller, opening it if necessary.
+    ///
+    /// Sessions are identified by backendID and devPath. opts is only used when the session is opened,
+    /// later calls share the session with the options of the first. \n
+    /// Calling close() on a returned controller has no effect, the session is closed when its last Ptr is released. \n
+    /// The device is opened without holding the registry lock, so that opening one device does not block
+    /// calls for other devices. Concurrent calls for the same device wait for its open to finish.
+    ///
+    /// \throws Exception
+    static Controller::Ptr open(const std::string& backendID, const std::string& devPath, const ControllerOpts& opts) {
+        Registry& r = registry();
+        std::unique_lock<std::mutex> lock(r.mx);
+        Key key{backendID, devPath};
+        for (;;) {
+            auto it = r.sessions.find(key);
+            if (it == r.sessions.end()) {
+                break;
+            }
+            if (Controller::Ptr s = it->second.session.lock()) {
+                return s;
+            }
+            // The session is being opened, or its last reference was just released and it is closing its port.
+            std::shared_ptr<std::condition_variable> cv = it->second.cv;
+            cv->wait(lock);
+        }
+
+        // Register the session as opening, so that other calls for the key wait for it.
+        Entry& e = r.sessions[key];
+        e.cv = std::make_shared<std::condition_variable>();
+        lock.unlock();
+
+        std::shared_ptr<Session> s;
+        try {
+            s = std::make_shared<Session>(Controller::open(backendID, devPath, opts), key);
+        } catch (...) {
+            lock.lock();
+            std::shared_ptr<std::condition_variable> cv = r.sessions[key].cv;
+            r.sessions.erase(key);
+            lock.unlock();
+            cv->notify_all();
+            throw;
+        }
+
+        lock.lock();
+        Entry& opened = r.sessions[key];
+        opened.session = s;
+        std::shared_ptr<std::condition_variable> cv = opened.cv;
+        lock.unlock();
+        cv->notify_all();
+        return s;
+    }
+
+    /// \brief Returns the number of open sessions.
+    static size_t sessions() {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mx);
+        size_t n = 0;
+        for (const auto& [key, e] : r.sessions) {
+            n += !e.session.expired();
+        }
+        return n;
+    }
+
+private:
+    typedef std::pair<std::string, std::string> Key;
+
+    // A registered session. The session is expired while it is opened or closed,
+    // calls for its key wait on cv until it is available or removed.
+    struct Entry {
+        std::weak_ptr<Controller>                session;
+        std::shared_ptr<std::condition_variable> cv;
+    };
+
+    struct Registry {
+        std::map<Key, Entry> sessions;
+        std::mutex           mx;
+    };
+
+    // A controller shared by all users of a session. Closes its controller with the last reference.
+    class Session : public ForwardingController {
+    public:
+        Session(Controller::Ptr inner, const Key& key) : ForwardingController(inner), key_(key) {}
+
+        // The session stays registered until its port is closed, so that reopening the device waits for it.
+        ~Session() {
+            inner_->close();
+            Registry& r = registry();
+            std::shared_ptr<std::condition_variable> cv;
+            {
+                std::lock_guard<std::mutex> lock(r.mx);
+                auto it = r.sessions.find(key_);
+                if (it != r.sessions.end()) {
+                    cv = it->second.cv;
+                    r.sessions.erase(it);
+                }
+            }
+            if (cv) {
+                cv->notify_all();
+            }
+        }
+
+        void close() noexcept override {}
+
+    private:
+        const Key key_;
+    };
+
+    // Never destroyed, so that sessions released during static destruction still find it.
+    static Registry& registry() {
+        static Registry* r = new Registry;
+        return *r;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,441 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the PositionController, that tracks absolute step motor positions.
+///
+/// Most controllers do not support Controller::setStepMotorAbsPos(), so absolute moves require
+/// reading the current position first. The PositionController instead keeps an authoritative model
+/// of every step motor's position and persists it in the state directory. Absolute moves are then
+/// translated to relative moves without reading the controller. \n
+/// The MoveExecutor moves several step motors in parallel, absolutely or by their difference.
+#ifndef NLAB_CTRL_LIB_POSITION_HPP
+#define NLAB_CTRL_LIB_POSITION_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <future>
+#include <exception>
+#include <functional>
+#include <sstream>
+#include <fstream>
+#include <cerrno>
+#include <cstdio>
+#include <algorithm>
+
+#include <sys/stat.h>
+
+#include <libnlab-ctrl-forward.hpp>
+
+namespace nlab::ctrl {
+
+namespace detail {
+
+// Creates the parent directories of path.
+inline void makeParentDirs(const std::string& path) {
+    for (size_t n = path.find('/', 1); n != std::string::npos; n = path.find('/', n + 1)) {
+        mkdir(path.substr(0, n).c_str(), 0755);
+    }
+}
+
+// Writes content to a temporary file and renames it to path, so that path is never partially written.
+// what names the content in the error message.
+inline void writeFileAtomic(const std::string& path, const std::string& content, const std::string& what) {
+    makeParentDirs(path);
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream f(tmp, std::ios::trunc);
+        if (!(f << content).flush()) {
+            throw Exception(Exception::Generic, "failed to save " + what + ": " + tmp);
+        }
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        throw Exception(Exception::Generic, "failed to save " + what + ": " + path);
+    }
+}
+
+// Returns s as a double-quoted YAML scalar.
+inline std::string quote(const std::string& s) {
+    std::string q = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            q += '\\';
+        }
+        q += c;
+    }
+    return q + "\"";
+}
+
+// Parses the key of a "key: value" line, which is either double-quoted or plain.
+// Returns the offset of the value, or npos if the line has no key.
+inline size_t parseKey(const std::string& line, size_t pos, std::string& key) {
+    key.clear();
+    if (pos < line.size() && line[pos] == '"') {
+        for (size_t i = pos + 1; i < line.size(); ++i) {
+            if (line[i] == '\\' && i + 1 < line.size()) {
+                key += line[++i];
+            } else if (line[i] == '"') {
+                return i + 1 < line.size() && line[i + 1] == ':' ? i + 2 : std::string::npos;
+            } else {
+                key += line[i];
+            }
+        }
+        return std::string::npos;
+    }
+    size_t n = line.find(':', pos);
+    if (n == std::string::npos) {
+        return n;
+    }
+    key = line.substr(pos, n - pos);
+    return n + 1;
+}
+
+}
+
+/// \brief A Controller that tracks the absolute position of its step motors.
+///
+/// The first time a step motor is used, its position and limits are read from the controller,
+/// unless they are known from the state file. Afterwards, the model is updated with every move
+/// and reported by getStepMotor() and getStepMotors(). \n
+/// The model is only correct as long as no other process moves the motors.
+/// Use home() or resync() to correct it. \n
+/// Moves of different step motors run concurrently, moves of the same step motor one after another.
+/// The state file is written after every move, moves that finish while it is written are saved together.
+/// Failures to write it do not fail the move, see flush() and saveError().
+class PositionController : public ForwardingController {
+public:
+    /// \brief Static factory method that opens a controller and tracks its step motors.
+    ///
+    /// The model is persisted to the file <backendID>-positions.yaml in ControllerOpts::stateDir,
+    /// which defaults to "state", like the state of the controller itself.
+    ///
+    /// \param[in]  backendID  The id of the backend to use.
+    /// \param[in]  devPath    The device path on the host.
+    /// \param[in]  opts       Optional parameters of the controller.
+    ///
+    /// \return A Ptr to a Controller ready to use.
+    /// \throws Exception
+    static Ptr open(const std::string& backendID, const std::string& devPath, const ControllerOpts& opts) {
+        std::string dir = opts.stateDir.empty() ? "state" : opts.stateDir;
+        Controller::Ptr inner = Controller::open(backendID, devPath, opts);
+        return std::make_shared<PositionController>(inner, dir + "/" + backendID + "-positions.yaml");
+    }
+
+    /// \brief Creates a controller that tracks the step motors of inner.
+    ///
+    /// \param[in]  inner      The controller to wrap.
+    /// \param[in]  statePath  The file the model is persisted to. If empty, the model is not persisted.
+    PositionController(Controller::Ptr inner, const std::string& statePath = std::string())
+        : ForwardingController(inner), statePath_(statePath) {
+        load();
+    }
+
+    std::vector<StepMotor> getStepMotors() override {
+        std::vector<StepMotor> sms = inner_->getStepMotors();
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            for (StepMotor& sm : sms) {
+                sm.step = track(sm).step;
+            }
+        }
+        persist();
+        return sms;
+    }
+
+    StepMotor getStepMotor(const std::string& id) override {
+        StepMotor sm = inner_->getStepMotor(id);
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            sm.step = track(sm).step;
+        }
+        persist();
+        return sm;
+    }
+
+    void setStepMotorRelPos(const std::string& id, int step) override {
+        std::lock_guard<std::mutex> motor(motorLock(id));
+        position(id);
+        inner_->setStepMotorRelPos(id, step);
+        update(id, [&](Position& p) { p.step = std::clamp(p.step + step, p.minStep, p.maxStep); });
+    }
+
+    /// \brief Sets the absolute position of a step motor.
+    ///
+    /// Sends the difference to the modelled position as a relative move. Works on every controller.
+    ///
+    /// \param[in]  id    The id of the step motor.
+    /// \param[in]  step  position the step motor should move to, bound by StepMotor::minStep and StepMotor::maxStep.
+    ///
+    /// \throws Exception
+    void setStepMotorAbsPos(const std::string& id, int step) override {
+        std::lock_guard<std::mutex> motor(motorLock(id));
+        Position p = position(id);
+        step = std::clamp(step, p.minStep, p.maxStep);
+        if (step == p.step) {
+            return;
+        }
+        inner_->setStepMotorRelPos(id, step - p.step);
+        update(id, [&](Position& q) { q.step = step; });
+    }
+
+    /// \brief Re-homes a step motor by driving it against its lower end stop.
+    ///
+    /// Moves the motor by the length of its whole range downwards,
+    /// so that it rests at StepMotor::minStep wherever it started.
+    ///
+    /// \param[in]  id  The id of the step motor.
+    ///
+    /// \throws Exception
+    void home(const std::string& id) {
+        std::lock_guard<std::mutex> motor(motorLock(id));
+        Position p = position(id);
+        inner_->setStepMotorRelPos(id, p.minStep - p.maxStep);
+        update(id, [&](Position& q) { q.step = q.minStep; });
+    }
+
+    /// \brief Replaces the model of a step motor with the position reported by the controller.
+    ///
+    /// \param[in]  id  The id of the step motor.
+    ///
+    /// \throws Exception
+    void resync(const std::string& id) {
+        std::lock_guard<std::mutex> motor(motorLock(id));
+        StepMotor sm = inner_->getStepMotor(id);
+        update(id, [&](Position& p) { p = Position{sm.step, sm.minStep, sm.maxStep}; });
+    }
+
+    /// \brief Writes the model to the state file, if it changed since the last successful write.
+    ///
+    /// Moves and getters never fail because the state file could not be written, they keep the model
+    /// and retry the write with the next change. Call flush() to learn whether the file is up to date.
+    ///
+    /// \throws Exception  If the file could not be written.
+    void flush() {
+        save();
+    }
+
+    /// \brief Returns the message of the last failed write of the state file, or an empty string,
+    /// if the last write succeeded.
+    std::string saveError() {
+        std::lock_guard<std::mutex> lock(mx_);
+        return saveError_;
+    }
+
+private:
+    struct Position {
+        int step;
+        int minStep;
+        int maxStep;
+    };
+
+    // Returns the mutex serializing the moves of the step motor.
+    std::mutex& motorLock(const std::string& id) {
+        std::lock_guard<std::mutex> lock(mx_);
+        return motorLocks_[id];
+    }
+
+    // Returns the model of the step motor, reading it from the controller if unknown.
+    Position position(const std::string& id) {
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            auto it = positions_.find(id);
+            if (it != positions_.end()) {
+                return it->second;
+            }
+        }
+        StepMotor sm = inner_->getStepMotor(id);
+        Position p;
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            p = track(sm);
+        }
+        persist();
+        return p;
+    }
+
+    // Returns the model of the step motor, adding it from sm if unknown. Requires mx_.
+    Position& track(const StepMotor& sm) {
+        auto it = positions_.find(sm.id);
+        if (it != positions_.end()) {
+            // The limits may have changed with the firmware.
+            it->second.minStep = sm.minStep;
+            it->second.maxStep = sm.maxStep;
+            return it->second;
+        }
+        version_++;
+        return positions_[sm.id] = Position{sm.step, sm.minStep, sm.maxStep};
+    }
+
+    // Applies fn to the model of the step motor and saves it.
+    template<typename F>
+    void update(const std::string& id, F fn) {
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            fn(positions_[id]);
+            version_++;
+        }
+        persist();
+    }
+
+    // Saves the model after a call that already took effect. A failure must not make the call fail,
+    // as a retry would repeat it, so it is only recorded for saveError() and the file stays dirty.
+    void persist() noexcept {
+        try {
+            save();
+        } catch (std::exception&) {
+        }
+    }
+
+    void load() {
+        if (statePath_.empty()) {
+            return;
+        }
+        std::ifstream in(statePath_);
+        std::string line, id;
+        while (std::getline(in, line)) {
+            size_t n = detail::parseKey(line, 0, id);
+            if (n == std::string::npos) {
+                continue;
+            }
+            Position p;
+            if (std::sscanf(line.c_str() + n, " {step: %d, min: %d, max: %d}", &p.step, &p.minStep, &p.maxStep) == 3) {
+                positions_[id] = p;
+            }
+        }
+        saved_ = version_;
+    }
+
+    // Writes the model, unless it is unchanged since the last write.
+    // The file is written outside of mx_, so that it never delays the moves of other step motors.
+    void save() {
+        if (statePath_.empty()) {
+            return;
+        }
+        std::lock_guard<std::mutex> saving(saveMx_);
+        std::ostringstream out;
+        unsigned long long version;
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            if (version_ == saved_) {
+                return;
+            }
+            version = version_;
+            for (const auto& [id, p] : positions_) {
+                out << detail::quote(id) << ": {step: " << p.step << ", min: " << p.minStep << ", max: " << p.maxStep << "}\n";
+            }
+        }
+        try {
+            detail::writeFileAtomic(statePath_, out.str(), "positions");
+        } catch (std::exception& e) {
+            std::lock_guard<std::mutex> lock(mx_);
+            saveError_ = e.what();
+            throw;
+        }
+        std::lock_guard<std::mutex> lock(mx_);
+        saved_ = version;
+        saveError_.clear();
+    }
+
+    const std::string                 statePath_;
+    std::map<std::string, Position>   positions_;
+    std::map<std::string, std::mutex> motorLocks_;
+    unsigned long long                version_ = 0;
+    unsigned long long                saved_   = 0;
+    std::string                       saveError_;
+    std::mutex                        mx_;
+    std::mutex                        saveMx_;
+};
+
+/// \brief How a MoveExecutor moves a step motor to its target.
+enum class MoveMode {
+    /// Moves by the difference between target and current position with Controller::setStepMotorRelPos().
+    /// Works on every controller, but requires the current position.
+    Relative,
+    /// Calls Controller::setStepMotorAbsPos(). Requires a controller supporting absolute moves,
+    /// e.g. a PositionController, that may also be wrapped by other controllers.
+    Absolute
+};
+
+/// \brief Moves several step motors in parallel, each on its own thread.
+///
+/// The executor is not thread-safe, but the moves it started run concurrently.
+/// They only move in parallel, if the controller does not serialize them.
+class MoveExecutor {
+public:
+    /// \brief Called on the moving thread after a move finished, with its exception if it failed.
+    typedef std::function<void(std::exception_ptr)> DoneFunc;
+
+    /// \brief Creates an executor for the step motors of ctrl.
+    MoveExecutor(Controller::Ptr ctrl, MoveMode mode) : ctrl_(ctrl), mode_(mode) {}
+
+    /// \brief Waits for all moves, ignoring their failures.
+    ~MoveExecutor() {
+        for (auto& m : moves_) {
+            m.wait();
+        }
+    }
+
+    MoveExecutor(const MoveExecutor&) = delete;
+    MoveExecutor& operator=(const MoveExecutor&) = delete;
+
+    /// \brief Starts moving a step motor.
+    ///
+    /// \param[in]  id    The id of the step motor.
+    /// \param[in]  from  The current position. Only used with MoveMode::Relative.
+    /// \param[in]  to    The target position.
+    /// \param[in]  done  Called after the move finished. Optional.
+    void start(const std::string& id, int from, int to, DoneFunc done = nullptr) {
+        moves_.push_back(std::async(std::launch::async, [this, id, from, to, done] {
+            try {
+                if (mode_ == MoveMode::Absolute) {
+                    ctrl_->setStepMotorAbsPos(id, to);
+                } else if (to != from) {
+                    ctrl_->setStepMotorRelPos(id, to - from);
+                }
+            } catch (...) {
+                if (done) {
+                    done(std::current_exception());
+                }
+                throw;
+            }
+            if (done) {
+                done(nullptr);
+            }
+        }));
+    }
+
+    /// \brief Waits for all moves started so far.
+    ///
+    /// \throws Exception  The first failure, after all moves finished.
+    void wait() {
+        std::exception_ptr err;
+        for (auto& m : moves_) {
+            try {
+                m.get();
+            } catch (...) {
+                if (!err) {
+                    err = std::current_exception();
+                }
+            }
+        }
+        moves_.clear();
+        if (err) {
+            std::rethrow_exception(err);
+        }
+    }
+
+private:
+    Controller::Ptr                ctrl_;
+    const MoveMode                 mode_;
+    std::vector<std::future<void>> moves_;
+};
+
+}
+
+#endif
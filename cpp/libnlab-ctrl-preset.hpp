@@ -0,0 +1,269 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the PresetStore, that saves and recalls named step motor and led configurations.
+#ifndef NLAB_CTRL_LIB_PRESET_HPP
+#define NLAB_CTRL_LIB_PRESET_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+
+#include <libnlab-ctrl-position.hpp>
+
+namespace nlab::ctrl {
+
+/// \brief The settings of a led stored in a Preset.
+struct LEDPreset {
+    bool on;          ///< The state of the led.
+    int  brightness;  ///< The brightness of the led.
+    bool strobeOn;    ///< A flag whether strobe is active.
+    int  strobeDelay; ///< The delay of the strobe in milliseconds.
+};
+
+/// \brief A named configuration of step motor positions and led settings.
+///
+/// Step motors and leds not contained in the preset are left untouched when it is applied.
+struct Preset {
+    std::map<std::string, int>       steps; ///< The positions of the step motors by id.
+    std::map<std::string, LEDPreset> leds;  ///< The settings of the leds by id.
+};
+
+/// \brief Stores named Presets alongside the controller state and applies them.
+///
+/// All methods may be called from any thread.
+class PresetStore {
+public:
+    /// \brief Returns the default path of the preset file of a controller.
+    ///
+    /// This is the file <backendID>-presets.yaml in ControllerOpts::stateDir, which defaults to "state".
+    static std::string statePath(const std::string& backendID, const ControllerOpts& opts) {
+        return (opts.stateDir.empty() ? "state" : opts.stateDir) + "/" + backendID + "-presets.yaml";
+    }
+
+    /// \brief Creates a store for the controller.
+    ///
+    /// With MoveMode::Absolute, e.g. if ctrl is or wraps a PositionController,
+    /// presets move the step motors without reading their positions first.
+    ///
+    /// \param[in]  ctrl       The controller.
+    /// \param[in]  statePath  The file the presets are persisted to. If empty, the presets are not persisted.
+    /// \param[in]  mode       How step motors are moved to their positions.
+    PresetStore(Controller::Ptr ctrl, const std::string& statePath = std::string(), MoveMode mode = MoveMode::Relative)
+        : ctrl_(ctrl), statePath_(statePath), mode_(mode) {
+        load();
+    }
+
+    /// \brief Returns the names of all presets.
+    std::vector<std::string> names() {
+        std::lock_guard<std::mutex> lock(mx_);
+        std::vector<std::string> names;
+        for (const auto& [name, p] : presets_) {
+            names.push_back(name);
+        }
+        return names;
+    }
+
+    /// \brief Returns the preset with the given name.
+    ///
+    /// \throws Exception  With ErrCode Exception::NotFound, if there is no such preset.
+    Preset get(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mx_);
+        auto it = presets_.find(name);
+        if (it == presets_.end()) {
+            throw Exception(Exception::NotFound, "preset not found: " + name);
+        }
+        return it->second;
+    }
+
+    /// \brief Stores a preset, replacing any preset with the same name.
+    ///
+    /// \throws Exception
+    void put(const std::string& name, const Preset& p) {
+        std::lock_guard<std::mutex> lock(mx_);
+        std::map<std::string, Preset> presets = presets_;
+        presets[name] = p;
+        save(presets);
+        presets_.swap(presets);
+    }
+
+    /// \brief Stores the current positions of all step motors and settings of all leds as a preset.
+    ///
+    /// \return The stored preset.
+    /// \throws Exception
+    Preset capture(const std::string& name) {
+        Preset p;
+        for (const StepMotor& sm : ctrl_->getStepMotors()) {
+            p.steps[sm.id] = sm.step;
+        }
+        for (const LED& led : ctrl_->getLEDs()) {
+            p.leds[led.id] = LEDPreset{led.on, led.brightness, led.strobeOn, led.strobeDelay};
+        }
+        put(name, p);
+        return p;
+    }
+
+    /// \brief Removes a preset.
+    ///
+    /// \throws Exception
+    void remove(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mx_);
+        std::map<std::string, Preset> presets = presets_;
+        presets.erase(name);
+        save(presets);
+        presets_.swap(presets);
+    }
+
+    /// \brief Applies a preset.
+    ///
+    /// The step motors are moved by a MoveExecutor, while the leds are set.
+    /// They move in parallel, unless the controller serializes them.
+    /// Only values that differ from the current state are sent.
+    ///
+    /// \throws Exception  The first failure, after all other calls finished.
+    void apply(const std::string& name) {
+        Preset p = get(name);
+
+        std::map<std::string, int> current;
+        if (mode_ == MoveMode::Relative && !p.steps.empty()) {
+            for (const StepMotor& sm : ctrl_->getStepMotors()) {
+                current[sm.id] = sm.step;
+            }
+        }
+        MoveExecutor moves(ctrl_, mode_);
+        std::exception_ptr err;
+        for (const auto& [id, step] : p.steps) {
+            if (mode_ == MoveMode::Absolute) {
+                moves.start(id, step, step);
+                continue;
+            }
+            auto it = current.find(id);
+            if (it == current.end()) {
+                if (!err) {
+                    err = std::make_exception_ptr(Exception(Exception::NotFound, "control not found: " + id));
+                }
+                continue;
+            }
+            moves.start(id, it->second, step);
+        }
+
+        try {
+            if (!p.leds.empty()) {
+                std::map<std::string, LEDPreset> missing = p.leds;
+                for (const LED& led : ctrl_->getLEDs()) {
+                    auto it = p.leds.find(led.id);
+                    if (it == p.leds.end()) {
+                        continue;
+                    }
+                    missing.erase(led.id);
+                    const LEDPreset& lp = it->second;
+                    if (lp.brightness != led.brightness) ctrl_->setLEDBrightness(led.id, lp.brightness);
+                    if (lp.strobeDelay != led.strobeDelay) ctrl_->setLEDStrobeDelay(led.id, lp.strobeDelay);
+                    if (lp.strobeOn != led.strobeOn) ctrl_->setLEDStrobe(led.id, lp.strobeOn);
+                    if (lp.on != led.on) ctrl_->setLED(led.id, lp.on);
+                }
+                if (!missing.empty() && !err) {
+                    err = std::make_exception_ptr(Exception(Exception::NotFound, "control not found: " + missing.begin()->first));
+                }
+            }
+        } catch (...) {
+            if (!err) {
+                err = std::current_exception();
+            }
+        }
+        try {
+            moves.wait();
+        } catch (...) {
+            if (!err) {
+                err = std::current_exception();
+            }
+        }
+        if (err) {
+            std::rethrow_exception(err);
+        }
+    }
+
+private:
+    // The file is a YAML mapping of preset names, each with a mapping of steps and leds:
+    //
+    // "day":
+    //   steps:
+    //     "focus": 120
+    //   leds:
+    //     "led1": {on: 1, brightness: 50, strobeOn: 0, strobeDelay: 0}
+    void load() {
+        if (statePath_.empty()) {
+            return;
+        }
+        std::ifstream in(statePath_);
+        std::string line, key, name, section;
+        while (std::getline(in, line)) {
+            size_t indent = line.find_first_not_of(' ');
+            if (indent == std::string::npos) {
+                continue;
+            }
+            size_t n = detail::parseKey(line, indent, key);
+            if (n == std::string::npos) {
+                continue;
+            }
+            const char* value = line.c_str() + n;
+
+            if (indent == 0) {
+                name = key;
+                presets_[name];
+            } else if (indent == 2) {
+                section = key;
+            } else if (section == "steps") {
+                int step;
+                if (std::sscanf(value, " %d", &step) == 1) {
+                    presets_[name].steps[key] = step;
+                }
+            } else if (section == "leds") {
+                int on, brightness, strobeOn, strobeDelay;
+                if (std::sscanf(value, " {on: %d, brightness: %d, strobeOn: %d, strobeDelay: %d}",
+                                &on, &brightness, &strobeOn, &strobeDelay) == 4) {
+                    presets_[name].leds[key] = LEDPreset{on != 0, brightness, strobeOn != 0, strobeDelay};
+                }
+            }
+        }
+    }
+
+    // Writes presets to the file. The callers only commit presets to memory after the write succeeded.
+    void save(const std::map<std::string, Preset>& presets) {
+        if (statePath_.empty()) {
+            return;
+        }
+        std::ostringstream out;
+        for (const auto& [name, p] : presets) {
+            out << detail::quote(name) << ":\n  steps:\n";
+            for (const auto& [id, step] : p.steps) {
+                out << "    " << detail::quote(id) << ": " << step << "\n";
+            }
+            out << "  leds:\n";
+            for (const auto& [id, l] : p.leds) {
+                out << "    " << detail::quote(id) << ": {on: " << l.on << ", brightness: " << l.brightness
+                    << ", strobeOn: " << l.strobeOn << ", strobeDelay: " << l.strobeDelay << "}\n";
+            }
+        }
+        detail::writeFileAtomic(statePath_, out.str(), "presets");
+    }
+
+    Controller::Ptr                 ctrl_;
+    const std::string               statePath_;
+    const MoveMode                  mode_;
+    std::map<std::string, Preset>   presets_;
+    std::mutex                      mx_;
+};
+
+}
+
+#endif
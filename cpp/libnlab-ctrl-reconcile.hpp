@@ -0,0 +1,249 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the Reconciler, that converges a controller on a declared target state.
+///
+/// Instead of a sequence of setters, the caller describes the complete DesiredState.
+/// The Reconciler reads the current state once per resource list, plans only the commands
+/// for values that differ and executes them: step motors move in parallel, while the leds, switches
+/// and gpio pins are set. Leds are configured before they are switched on.
+#ifndef NLAB_CTRL_LIB_RECONCILE_HPP
+#define NLAB_CTRL_LIB_RECONCILE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <exception>
+#include <functional>
+#include <algorithm>
+
+#include <libnlab-ctrl-preset.hpp>
+
+namespace nlab::ctrl {
+
+/// \brief The target state of a controller.
+///
+/// Resources not contained are left untouched.
+struct DesiredState {
+    std::map<std::string, int>       steps;    ///< The positions of the step motors by id.
+    std::map<std::string, LEDPreset> leds;     ///< The settings of the leds by id.
+    std::map<std::string, bool>      switches; ///< The states of the switches by id.
+    std::map<std::string, bool>      gpioPins; ///< The states of the gpio output pins by id. Requires enabled gpio pins.
+};
+
+/// \brief A single command planned by a Reconciler.
+struct ReconcileAction {
+    /// \brief The controller method an action calls.
+    enum Kind {
+        MoveStepMotor,     ///< Moves a step motor from from to to.
+        SetLEDBrightness,  ///< Calls Controller::setLEDBrightness() with to.
+        SetLEDStrobeDelay, ///< Calls Controller::setLEDStrobeDelay() with to.
+        SetLEDStrobe,      ///< Calls Controller::setLEDStrobe() with to != 0.
+        SetLED,            ///< Calls Controller::setLED() with to != 0.
+        SetSwitch,         ///< Calls Controller::setSwitch() with to != 0.
+        SetGPIOPin         ///< Calls Controller::setGPIOPin() with to != 0.
+    };
+
+    Kind        kind; ///< The method to call.
+    std::string id;   ///< The id of the resource.
+    int         from; ///< The current value.
+    int         to;   ///< The desired value.
+};
+
+/// \brief Reports the progress of Reconciler::apply().
+struct ReconcileProgress {
+    const ReconcileAction& action; ///< The action that finished.
+    size_t                 done;   ///< Number of finished actions, including this one.
+    size_t                 total;  ///< Number of planned actions.
+    bool                   ok;     ///< False, if the action failed.
+    std::string            error;  ///< The message of the failure, if not ok.
+};
+
+/// \brief Computes and executes the commands that converge a controller on a DesiredState.
+///
+/// All methods may be called from any thread.
+class Reconciler {
+public:
+    /// \brief Called after every finished action. Calls are serialised, but may come from different threads.
+    typedef std::function<void(const ReconcileProgress&)> ProgressFunc;
+
+    /// \brief Creates a reconciler for the controller.
+    ///
+    /// With MoveMode::Absolute, e.g. if ctrl is or wraps a PositionController,
+    /// step motors are moved to their absolute positions instead of by the difference to the position read.
+    ///
+    /// \param[in]  ctrl  The controller.
+    /// \param[in]  mode  How step motors are moved to their positions.
+    explicit Reconciler(Controller::Ptr ctrl, MoveMode mode = MoveMode::Relative) : ctrl_(ctrl), mode_(mode) {}
+
+    /// \brief Returns the actions needed to converge on desired, in the order they are started.
+    ///
+    /// \throws Exception  With ErrCode Exception::NotFound, if desired contains an unknown resource.
+    std::vector<ReconcileAction> plan(const DesiredState& desired) {
+        std::vector<ReconcileAction> actions;
+
+        if (!desired.steps.empty()) {
+            std::map<std::string, StepMotor> current = byID(ctrl_->getStepMotors());
+            for (const auto& [id, step] : desired.steps) {
+                const StepMotor& sm = find(current, id);
+                int to = std::clamp(step, sm.minStep, sm.maxStep);
+                if (to != sm.step) {
+                    actions.push_back({ReconcileAction::MoveStepMotor, id, sm.step, to});
+                }
+            }
+        }
+
+        if (!desired.leds.empty()) {
+            std::map<std::string, LED> current = byID(ctrl_->getLEDs());
+            for (const auto& [id, lp] : desired.leds) {
+                const LED& l = find(current, id);
+                diff(actions, ReconcileAction::SetLEDBrightness, id, l.brightness, lp.brightness);
+                diff(actions, ReconcileAction::SetLEDStrobeDelay, id, l.strobeDelay, lp.strobeDelay);
+                diff(actions, ReconcileAction::SetLEDStrobe, id, l.strobeOn, lp.strobeOn);
+                diff(actions, ReconcileAction::SetLED, id, l.on, lp.on);
+            }
+        }
+
+        if (!desired.switches.empty()) {
+            std::map<std::string, Switch> current = byID(ctrl_->getSwitches());
+            for (const auto& [id, on] : desired.switches) {
+                diff(actions, ReconcileAction::SetSwitch, id, find(current, id).on, on);
+            }
+        }
+
+        if (!desired.gpioPins.empty()) {
+            std::map<std::string, GPIOPin> current = byID(ctrl_->getGPIOPins());
+            for (const auto& [id, on] : desired.gpioPins) {
+                diff(actions, ReconcileAction::SetGPIOPin, id, find(current, id).on, on);
+            }
+        }
+        return actions;
+    }
+
+    /// \brief Executes the actions of a plan.
+    ///
+    /// The step motors are moved in parallel by a MoveExecutor, while the remaining actions are executed in order.
+    /// A failed action does not stop the others.
+    ///
+    /// \throws Exception  The first failure, after all other actions finished.
+    void apply(const std::vector<ReconcileAction>& actions, ProgressFunc onProgress = nullptr) {
+        size_t done = 0;
+        std::mutex mx;
+        auto finished = [&](const ReconcileAction& a, std::exception_ptr e) {
+            std::string error;
+            if (e) {
+                try {
+                    std::rethrow_exception(e);
+                } catch (std::exception& ex) {
+                    error = ex.what();
+                } catch (...) {
+                    error = "unknown error";
+                }
+            }
+            std::lock_guard<std::mutex> lock(mx);
+            report(onProgress, a, ++done, actions.size(), !e, error);
+        };
+
+        MoveExecutor moves(ctrl_, mode_);
+        for (const ReconcileAction& a : actions) {
+            if (a.kind == ReconcileAction::MoveStepMotor) {
+                moves.start(a.id, a.from, a.to, [&finished, &a](std::exception_ptr e) { finished(a, e); });
+            }
+        }
+
+        std::exception_ptr err;
+        for (const ReconcileAction& a : actions) {
+            if (a.kind == ReconcileAction::MoveStepMotor) {
+                continue;
+            }
+            try {
+                execute(a);
+            } catch (...) {
+                if (!err) {
+                    err = std::current_exception();
+                }
+                finished(a, std::current_exception());
+                continue;
+            }
+            finished(a, nullptr);
+        }
+        try {
+            moves.wait();
+        } catch (...) {
+            if (!err) {
+                err = std::current_exception();
+            }
+        }
+        if (err) {
+            std::rethrow_exception(err);
+        }
+    }
+
+    /// \brief Plans and applies the actions needed to converge on desired.
+    ///
+    /// \return The number of actions executed.
+    /// \throws Exception  The first failure, after all other actions finished.
+    size_t reconcile(const DesiredState& desired, ProgressFunc onProgress = nullptr) {
+        std::vector<ReconcileAction> actions = plan(desired);
+        apply(actions, onProgress);
+        return actions.size();
+    }
+
+private:
+    template<typename T>
+    static std::map<std::string, T> byID(std::vector<T> values) {
+        std::map<std::string, T> m;
+        for (T& v : values) {
+            std::string id = v.id;
+            m.emplace(std::move(id), std::move(v));
+        }
+        return m;
+    }
+
+    template<typename T>
+    static const T& find(const std::map<std::string, T>& m, const std::string& id) {
+        auto it = m.find(id);
+        if (it == m.end()) {
+            throw Exception(Exception::NotFound, "control not found: " + id);
+        }
+        return it->second;
+    }
+
+    static void diff(std::vector<ReconcileAction>& actions, ReconcileAction::Kind kind, const std::string& id, int from, int to) {
+        if (from != to) {
+            actions.push_back({kind, id, from, to});
+        }
+    }
+
+    static void report(const ProgressFunc& fn, const ReconcileAction& a, size_t done, size_t total, bool ok,
+                       const std::string& error) {
+        if (fn) {
+            fn(ReconcileProgress{a, done, total, ok, error});
+        }
+    }
+
+    void execute(const ReconcileAction& a) {
+        switch (a.kind) {
+        case ReconcileAction::MoveStepMotor:     break; // Moved by the MoveExecutor.
+        case ReconcileAction::SetLEDBrightness:  ctrl_->setLEDBrightness(a.id, a.to); break;
+        case ReconcileAction::SetLEDStrobeDelay: ctrl_->setLEDStrobeDelay(a.id, a.to); break;
+        case ReconcileAction::SetLEDStrobe:      ctrl_->setLEDStrobe(a.id, a.to != 0); break;
+        case ReconcileAction::SetLED:            ctrl_->setLED(a.id, a.to != 0); break;
+        case ReconcileAction::SetSwitch:         ctrl_->setSwitch(a.id, a.to != 0); break;
+        case ReconcileAction::SetGPIOPin:        ctrl_->setGPIOPin(a.id, a.to != 0); break;
+        }
+    }
+
+    Controller::Ptr ctrl_;
+    const MoveMode  mode_;
+};
+
+}
+
+#endif
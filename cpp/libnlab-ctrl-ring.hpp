@@ -0,0 +1,429 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the CommandRing, a fast path to issue high rates of controller calls.
+///
+/// Every Controller call crosses into the embedded Go runtime, which costs a thread handoff each time.
+/// The CommandRing instead lets any number of threads enqueue fixed-size Command records into a
+/// lock-free ring. A single worker thread, optionally pinned to a cpu, drains the ring and performs
+/// the calls back to back. Their results are returned through a second ring of Completion records.
+///
+/// Submitting a command costs a few atomic operations, as long as the worker is busy. \n
+/// Optionally, the worker signals a pollable file descriptor for every completion, so that
+/// single-threaded event loops can add CommandRing::fd() to epoll and call CommandRing::process() when it is readable.
+#ifndef NLAB_CTRL_LIB_RING_HPP
+#define NLAB_CTRL_LIB_RING_HPP
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <cstdint>
+#include <cstring>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <libnlab-ctrl.hpp>
+
+namespace nlab::ctrl {
+
+//###############//
+//### Command ###//
+//###############//
+
+/// \brief Maximum length of a resource id in a Command, including the terminating NUL.
+const size_t CommandIDSize = 48;
+
+/// \brief Maximum length of an error message in a Completion, including the terminating NUL.
+const size_t CompletionMsgSize = 96;
+
+/// \brief A fixed-size record describing one controller call.
+struct Command {
+    /// \brief The controller method a Command calls.
+    enum Op : uint8_t {
+        SetStepMotorRelPos,           ///< Calls Controller::setStepMotorRelPos() with value.
+        SetStepMotorAbsPos,           ///< Calls Controller::setStepMotorAbsPos() with value.
+        SetStatusLED,                 ///< Calls Controller::setStatusLED() with value.
+        SetStatusLEDBlinkingDuration, ///< Calls Controller::setStatusLEDBlinkingDuration() with value.
+        SetLED,                       ///< Calls Controller::setLED() with value != 0.
+        SetLEDStrobe,                 ///< Calls Controller::setLEDStrobe() with value != 0.
+        SetLEDBrightness,             ///< Calls Controller::setLEDBrightness() with value.
+        SetLEDStrobeDelay,            ///< Calls Controller::setLEDStrobeDelay() with value.
+        SetSwitch,                    ///< Calls Controller::setSwitch() with value != 0.
+        SetGPIOPin,                   ///< Calls Controller::setGPIOPin() with value != 0.
+        GetSwitch,                    ///< Calls Controller::getSwitch(), Completion::value is its on state.
+        GetGPIOPin,                   ///< Calls Controller::getGPIOPin(), Completion::value is its on state.
+        Temperature                   ///< Calls Controller::temperature(), Completion::value is the temperature.
+    };
+
+    uint64_t      ticket;             ///< Identifies the command, assigned by CommandRing::submit().
+    Op            op;                 ///< The method to call.
+    char          id[CommandIDSize];  ///< The id of the resource, if the method takes one.
+    long long int value;              ///< The argument of the method, if it takes one.
+};
+
+/// \brief A fixed-size record describing the result of a Command.
+struct Completion {
+    uint64_t           ticket;                 ///< The ticket of the Command.
+    bool               ok;                     ///< True, if the call succeeded.
+    Exception::ErrCode code;                   ///< The ErrCode of the failure, if not ok.
+    char               msg[CompletionMsgSize]; ///< The truncated message of the failure, if not ok.
+    double             value;                  ///< The result of a getter.
+};
+
+//############//
+//### Ring ###//
+//############//
+
+/// \brief A bounded lock-free ring that supports multiple producers and consumers.
+///
+/// Each slot carries a sequence number, that tells producers and consumers whether
+/// it is free or filled for the current lap. The capacity is rounded up to a power of two.
+template<typename T>
+class Ring {
+public:
+    /// \brief Creates a ring that holds up to capacity elements.
+    explicit Ring(size_t capacity) : mask_(roundUp(capacity) - 1), slots_(mask_ + 1) {
+        for (size_t i = 0; i <= mask_; ++i) {
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /// \brief Appends v, unless the ring is full.
+    ///
+    /// \return False, if the ring is full.
+    bool push(const T& v) noexcept {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& s = slots_[pos & mask_];
+            size_t seq = s.seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    s.v = v;
+                    s.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// \brief Removes the oldest element and stores it in v, unless the ring is empty.
+    ///
+    /// \return False, if the ring is empty.
+    bool pop(T& v) noexcept {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& s = slots_[pos & mask_];
+            size_t seq = s.seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    v = s.v;
+                    s.seq.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// \brief Returns true, if the ring holds no elements.
+    bool empty() const noexcept {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> seq;
+        T                   v;
+    };
+
+    static size_t roundUp(size_t n) {
+        size_t c = 2;
+        while (c < n) {
+            c <<= 1;
+        }
+        return c;
+    }
+
+    const size_t      mask_;
+    std::vector<Slot> slots_;
+
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+//###################//
+//### CommandRing ###//
+//###################//
+
+/// \brief Options for a CommandRing.
+///
+/// For every member that is not set a sensible default value is used. This means that an empty struct represents default options.
+struct CommandRingOpts {
+    /// \brief The number of commands and completions each ring can hold. Defaults to 1024.
+    size_t capacity = 1024;
+
+    /// \brief The cpu the worker thread is pinned to. Defaults to -1, which leaves it unpinned.
+    int cpu = -1;
+
+    /// \brief Number of empty polls, before the worker goes to sleep. Defaults to 4096.
+    ///
+    /// While the worker spins, submitting a command requires no system call.
+    int spin = 4096;
+
+    /// \brief Signals CommandRing::fd() for every completion. Defaults to false.
+    ///
+    /// Costs a system call per completion on the worker thread.
+    bool signal = false;
+};
+
+/// \brief Executes Commands on a dedicated worker thread.
+///
+/// submit() may be called from any number of threads. Completions must be consumed by poll(),
+/// otherwise the worker stalls once the completion ring is full. While the ring is destroyed,
+/// completions that do not fit anymore are dropped.
+class CommandRing {
+public:
+    /// \brief Creates a ring for the controller and starts its worker thread.
+    ///
+    /// \param[in]  ctrl  The controller to call.
+    /// \param[in]  opts  Optional parameters of the ring.
+    ///
+    /// \throws Exception  If CommandRingOpts::signal is set and the eventfd could not be created,
+    ///                    or if the worker could not be pinned to CommandRingOpts::cpu.
+    CommandRing(Controller::Ptr ctrl, const CommandRingOpts& opts = CommandRingOpts())
+        : ctrl_(ctrl), opts_(opts), cmds_(opts.capacity), completions_(opts.capacity) {
+        if (opts_.signal) {
+            fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (fd_ < 0) {
+                throw Exception(Exception::Generic, "ring: failed to create eventfd");
+            }
+        }
+        worker_ = std::thread([this] { run(); });
+
+        if (opts_.cpu >= 0) {
+            int err = EINVAL;
+            if (opts_.cpu < CPU_SETSIZE) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(opts_.cpu, &set);
+                err = pthread_setaffinity_np(worker_.native_handle(), sizeof(set), &set);
+            }
+            if (err != 0) {
+                stop();
+                throw Exception(Exception::Generic, "ring: failed to pin worker to cpu " + std::to_string(opts_.cpu) +
+                                                    ": " + std::strerror(err));
+            }
+        }
+    }
+
+    /// \brief Executes all submitted commands and stops the worker thread.
+    ~CommandRing() {
+        stop();
+    }
+
+    CommandRing(const CommandRing&) = delete;
+    CommandRing& operator=(const CommandRing&) = delete;
+
+    /// \brief Enqueues a command.
+    ///
+    /// \param[in]  op     The method to call.
+    /// \param[in]  id     The id of the resource. Longer ids are rejected.
+    /// \param[in]  value  The argument of the method.
+    ///
+    /// \return The ticket of the command, or 0, if the ring is full or the id too long.
+    uint64_t submit(Command::Op op, const std::string& id = std::string(), long long int value = 0) noexcept {
+        if (id.size() >= CommandIDSize) {
+            return 0;
+        }
+        Command c;
+        c.ticket = nextTicket_.fetch_add(1, std::memory_order_relaxed);
+        c.op = op;
+        std::memcpy(c.id, id.c_str(), id.size() + 1);
+        c.value = value;
+        if (!cmds_.push(c)) {
+            return 0;
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping_.load()) {
+            wake();
+        }
+        return c.ticket;
+    }
+
+    /// \brief Retrieves the next completion.
+    ///
+    /// Completions are delivered in the order the worker executed their commands.
+    ///
+    /// \param[out]  c  The completion.
+    ///
+    /// \return False, if no completion is available.
+    bool poll(Completion& c) noexcept {
+        return completions_.pop(c);
+    }
+
+    /// \brief Returns a file descriptor, that becomes readable when completions are available.
+    ///
+    /// Only valid if CommandRingOpts::signal is set, otherwise -1. Do not read from or close it, use process() instead.
+    int fd() const noexcept { return fd_; }
+
+    /// \brief Passes up to max available completions to fn, without blocking.
+    ///
+    /// Intended to be called from an event loop when fd() is readable.
+    /// If completions remain after max, fd() stays readable.
+    ///
+    /// \return The number of completions passed to fn.
+    size_t process(const std::function<void(const Completion&)>& fn, size_t max = SIZE_MAX) {
+        // Reset the counter before draining, so that a completion pushed meanwhile signals again.
+        if (fd_ >= 0) {
+            uint64_t v;
+            ssize_t r = ::read(fd_, &v, sizeof(v));
+            (void)r;
+        }
+        size_t n = 0;
+        Completion c;
+        while (n < max && completions_.pop(c)) {
+            fn(c);
+            ++n;
+        }
+        if (n == max && fd_ >= 0 && !completions_.empty()) {
+            signal();
+        }
+        return n;
+    }
+
+private:
+    void stop() noexcept {
+        stopped_.store(true);
+        wake();
+        worker_.join();
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    void run() {
+        Command c;
+        int idle = 0;
+        for (;;) {
+            if (cmds_.pop(c)) {
+                idle = 0;
+                Completion r = execute(c);
+                while (!completions_.push(r) && !stopped_.load()) {
+                    std::this_thread::yield();
+                }
+                if (fd_ >= 0) {
+                    signal();
+                }
+                continue;
+            }
+            if (stopped_.load()) {
+                return;
+            }
+            if (++idle < opts_.spin) {
+                continue;
+            }
+
+            // Announce sleeping before checking the ring a last time,
+            // so that a concurrent submit() either is seen here or wakes us.
+            std::unique_lock<std::mutex> lock(mx_);
+            sleeping_.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            cv_.wait(lock, [this] { return !cmds_.empty() || stopped_.load(); });
+            sleeping_.store(false);
+            idle = 0;
+        }
+    }
+
+    void signal() noexcept {
+        uint64_t one = 1;
+        ssize_t w = ::write(fd_, &one, sizeof(one));
+        (void)w;
+    }
+
+    void wake() noexcept {
+        try {
+            std::lock_guard<std::mutex> lock(mx_);
+            cv_.notify_one();
+        } catch (...) {
+            // Locking failed, notify anyway. The worker waits at most until the next submit().
+            cv_.notify_one();
+        }
+    }
+
+    Completion execute(const Command& c) noexcept {
+        Completion r = {};
+        r.ticket = c.ticket;
+        r.ok = true;
+        try {
+            switch (c.op) {
+            case Command::SetStepMotorRelPos:           ctrl_->setStepMotorRelPos(c.id, static_cast<int>(c.value)); break;
+            case Command::SetStepMotorAbsPos:           ctrl_->setStepMotorAbsPos(c.id, static_cast<int>(c.value)); break;
+            case Command::SetStatusLED:                 ctrl_->setStatusLED(static_cast<StatusLEDState>(c.value)); break;
+            case Command::SetStatusLEDBlinkingDuration: ctrl_->setStatusLEDBlinkingDuration(c.value); break;
+            case Command::SetLED:                       ctrl_->setLED(c.id, c.value != 0); break;
+            case Command::SetLEDStrobe:                 ctrl_->setLEDStrobe(c.id, c.value != 0); break;
+            case Command::SetLEDBrightness:             ctrl_->setLEDBrightness(c.id, static_cast<int>(c.value)); break;
+            case Command::SetLEDStrobeDelay:            ctrl_->setLEDStrobeDelay(c.id, static_cast<int>(c.value)); break;
+            case Command::SetSwitch:                    ctrl_->setSwitch(c.id, c.value != 0); break;
+            case Command::SetGPIOPin:                   ctrl_->setGPIOPin(c.id, c.value != 0); break;
+            case Command::GetSwitch:                    r.value = ctrl_->getSwitch(c.id).on; break;
+            case Command::GetGPIOPin:                   r.value = ctrl_->getGPIOPin(c.id).on; break;
+            case Command::Temperature:                  r.value = ctrl_->temperature(); break;
+            default:
+                throw Exception(Exception::Generic, "invalid command");
+            }
+        } catch (Exception& e) {
+            r.ok = false;
+            r.code = e.code();
+            std::strncpy(r.msg, e.what(), CompletionMsgSize - 1);
+        } catch (std::exception& e) {
+            r.ok = false;
+            r.code = Exception::Generic;
+            std::strncpy(r.msg, e.what(), CompletionMsgSize - 1);
+        } catch (...) {
+            r.ok = false;
+            r.code = Exception::Generic;
+            std::strncpy(r.msg, "unknown error", CompletionMsgSize - 1);
+        }
+        return r;
+    }
+
+    Controller::Ptr         ctrl_;
+    const CommandRingOpts   opts_;
+    Ring<Command>           cmds_;
+    Ring<Completion>        completions_;
+    int                     fd_ = -1;
+    std::atomic<uint64_t>   nextTicket_{1};
+    std::atomic<bool>       stopped_{false};
+    std::atomic<bool>       sleeping_{false};
+    std::mutex              mx_;
+    std::condition_variable cv_;
+    std::thread             worker_;
+};
+
+}
+
+#endif
@@ -0,0 +1,347 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the API to tune and isolate the runtime embedded in the library.
+///
+/// libnlab-ctrl.so embeds the Go runtime, which starts its own scheduler, gc and service threads
+/// as soon as the library is loaded. The functions in this file allow to restrict those threads
+/// to a set of cpus, to configure the scheduler and gc, and to inspect what the runtime consumes.
+///
+/// The Go runtime reads its settings once from the environment the process was started with.
+/// That is why nlab_ctrl_runtime_init() must be the first call in main().
+#ifndef NLAB_CTRL_LIB_RUNTIME_H
+#define NLAB_CTRL_LIB_RUNTIME_H
+
+// syscall() and setenv() are not declared in strict ISO C modes.
+// Include this header first, or define _DEFAULT_SOURCE or _GNU_SOURCE yourself.
+#if !defined(_DEFAULT_SOURCE) && !defined(_GNU_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <libnlab-ctrl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// \brief Disables the garbage collector, if used as nlab_ctrl_runtime_opts::gc_percent.
+#define NLAB_CTRL_RUNTIME_GC_OFF -1
+
+/// \brief Maximum number of cpus supported in nlab_ctrl_runtime_opts::cpus.
+#define NLAB_CTRL_RUNTIME_MAX_CPUS 1024
+
+/// \brief Maximum number of runtime threads tracked by nlab_ctrl_runtime_get_stats().
+#define NLAB_CTRL_RUNTIME_MAX_THREADS 256
+
+/// \brief Set in the environment of a process re-executed by nlab_ctrl_runtime_init().
+#define NLAB_CTRL_RUNTIME_REEXEC_ENV "NLAB_CTRL_RUNTIME_REEXEC"
+
+/// \brief Options for the runtime.
+///
+/// For every member that is not set the runtime keeps its default. This means that an empty struct changes nothing.
+typedef struct {
+    /// \brief Maximum number of threads executing runtime code simultaneously (GOMAXPROCS).
+    int max_procs;
+
+    /// \brief Garbage collection target percentage (GOGC).
+    ///
+    /// Use ::NLAB_CTRL_RUNTIME_GC_OFF to disable the garbage collector.
+    int gc_percent;
+
+    /// \brief Soft memory limit of the runtime in bytes (GOMEMLIMIT).
+    ///
+    /// Only honored by runtimes built with Go 1.19 or newer.
+    long long int memory_limit;
+
+    /// \brief The cpus the runtime threads are allowed to run on.
+    ///
+    /// Applied to the runtime threads alive when nlab_ctrl_runtime_init() is called.
+    /// Threads the runtime starts later take the affinity of the thread they are created from,
+    /// which may be an application thread calling into the library. Pin such threads with
+    /// nlab_ctrl_runtime_pin_service_thread() to keep runtime code off other cpus.
+    /// Leave it NULL to keep the affinity of the process.
+    const int* cpus;
+
+    /// \brief The number of elements in cpus.
+    int cpus_size;
+
+    /// \brief Re-executes the process, if the runtime was started with other settings.
+    ///
+    /// max_procs, gc_percent and memory_limit can only be applied when the runtime starts.
+    /// If this flag is set and the process was not started with them, the process image is replaced
+    /// by a new instance of itself with the same arguments and the settings applied to its environment.
+    /// The new instance then runs up to this call again and continues normally.
+    /// The process is re-executed at most once: if the settings are still missing in the new instance,
+    /// e.g. because /proc/self/environ is not readable, the call fails there.
+    /// If the flag is not set, the call fails instead.
+    bool reexec;
+} nlab_ctrl_runtime_opts;
+
+/// \brief Contains statistics about the runtime.
+typedef struct {
+    int           threads;      ///< The number of runtime threads alive, that were found by nlab_ctrl_runtime_init().
+    long long int cpu_time;     ///< The cpu time in nanoseconds those threads consumed so far.
+    int           max_procs;    ///< GOMAXPROCS the runtime started with, or 0 for the default.
+    int           gc_percent;   ///< GOGC the runtime started with, or 0 for the default.
+    long long int memory_limit; ///< GOMEMLIMIT the runtime started with, or 0 for the default.
+} nlab_ctrl_runtime_stats;
+
+/// \brief Internal state shared by all translation units.
+typedef struct {
+    int tids[NLAB_CTRL_RUNTIME_MAX_THREADS];
+    int tids_size;
+} nlab_ctrl_runtime_state;
+
+/// \brief Internal state. Do not use directly.
+__attribute__((weak)) nlab_ctrl_runtime_state nlab_ctrl_runtime_state_;
+
+/// \brief Sets err to the code and a copy of msg.
+static inline void nlab_ctrl_runtime_error_(nlab_ctrl_error* err, const char* msg, const char* detail) {
+    size_t size = strlen(msg) + (detail != NULL ? strlen(detail) + 2 : 0) + 1;
+    char* s = (char*)malloc(size);
+    if (s == NULL) {
+        nlab_ctrl_error_set(err, NLAB_CTRL_ERR, NULL);
+        return;
+    }
+    if (detail != NULL) {
+        snprintf(s, size, "%s: %s", msg, detail);
+    } else {
+        snprintf(s, size, "%s", msg);
+    }
+    nlab_ctrl_error_set(err, NLAB_CTRL_ERR, s);
+}
+
+/// \brief Reads the file at path into a new NUL-terminated buffer and returns it, or NULL on failure.
+static inline char* nlab_ctrl_runtime_read_file_(const char* path, size_t* size) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return NULL;
+    }
+    size_t cap = 4096;
+    size_t len = 0;
+    char* buf = (char*)malloc(cap);
+    while (buf != NULL) {
+        len += fread(buf + len, 1, cap - len - 1, f);
+        if (len < cap - 1) {
+            break;
+        }
+        cap *= 2;
+        char* b = (char*)realloc(buf, cap);
+        if (b == NULL) {
+            free(buf);
+        }
+        buf = b;
+    }
+    fclose(f);
+    if (buf != NULL) {
+        buf[len] = '\0';
+        *size = len;
+    }
+    return buf;
+}
+
+/// \brief Looks up name in the environment the process was started with.
+///
+/// \return The value as integer, or 0, if not set.
+static inline long long int nlab_ctrl_runtime_start_env_(const char* name) {
+    size_t size = 0;
+    char* env = nlab_ctrl_runtime_read_file_("/proc/self/environ", &size);
+    if (env == NULL) {
+        return 0;
+    }
+    long long int v = 0;
+    size_t nlen = strlen(name);
+    for (size_t i = 0; i < size; i += strlen(env + i) + 1) {
+        if (strncmp(env + i, name, nlen) == 0 && env[i + nlen] == '=') {
+            const char* s = env + i + nlen + 1;
+            v = strcmp(s, "off") == 0 ? NLAB_CTRL_RUNTIME_GC_OFF : atoll(s);
+            break;
+        }
+    }
+    free(env);
+    return v;
+}
+
+/// \brief Sets the affinity of the thread tid to the cpus.
+static inline int nlab_ctrl_runtime_set_affinity_(int tid, const int* cpus, int cpus_size) {
+    unsigned long mask[NLAB_CTRL_RUNTIME_MAX_CPUS / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    for (int i = 0; i < cpus_size; ++i) {
+        if (cpus[i] < 0 || cpus[i] >= NLAB_CTRL_RUNTIME_MAX_CPUS) {
+            errno = EINVAL;
+            return -1;
+        }
+        mask[cpus[i] / (8 * sizeof(unsigned long))] |= 1UL << (cpus[i] % (8 * sizeof(unsigned long)));
+    }
+    return (int)syscall(SYS_sched_setaffinity, tid, sizeof(mask), mask);
+}
+
+/// \brief Replaces the process with a new instance of itself, that has the runtime settings in its environment.
+static inline void nlab_ctrl_runtime_reexec_(const nlab_ctrl_runtime_opts* opts, nlab_ctrl_error* err) {
+    char v[32];
+    if (opts->max_procs > 0) {
+        snprintf(v, sizeof(v), "%d", opts->max_procs);
+        setenv("GOMAXPROCS", v, 1);
+    }
+    if (opts->gc_percent != 0) {
+        if (opts->gc_percent == NLAB_CTRL_RUNTIME_GC_OFF) {
+            snprintf(v, sizeof(v), "off");
+        } else {
+            snprintf(v, sizeof(v), "%d", opts->gc_percent);
+        }
+        setenv("GOGC", v, 1);
+    }
+    if (opts->memory_limit > 0) {
+        snprintf(v, sizeof(v), "%lld", opts->memory_limit);
+        setenv("GOMEMLIMIT", v, 1);
+    }
+    setenv(NLAB_CTRL_RUNTIME_REEXEC_ENV, "1", 1);
+
+    size_t size = 0;
+    char* cmdline = nlab_ctrl_runtime_read_file_("/proc/self/cmdline", &size);
+    if (cmdline == NULL) {
+        nlab_ctrl_runtime_error_(err, "runtime: failed to read cmdline", strerror(errno));
+        return;
+    }
+    int argc = 0;
+    for (size_t i = 0; i < size; i += strlen(cmdline + i) + 1) {
+        argc++;
+    }
+    char** argv = (char**)calloc(argc + 1, sizeof(char*));
+    if (argv == NULL) {
+        free(cmdline);
+        nlab_ctrl_runtime_error_(err, "runtime: out of memory", NULL);
+        return;
+    }
+    argc = 0;
+    for (size_t i = 0; i < size; i += strlen(cmdline + i) + 1) {
+        argv[argc++] = cmdline + i;
+    }
+
+    execv("/proc/self/exe", argv);
+
+    // Only reached on failure.
+    nlab_ctrl_runtime_error_(err, "runtime: failed to re-execute process", strerror(errno));
+    unsetenv(NLAB_CTRL_RUNTIME_REEXEC_ENV);
+    free(argv);
+    free(cmdline);
+}
+
+/// \brief Configures the runtime embedded in the library.
+///
+/// Must be called from the main thread, before the application starts any other thread,
+/// as all threads except the calling one are considered to belong to the runtime.
+///
+/// \param[in]     opts       The runtime options.
+/// \param[in,out] ctrl_err   Used to communicate the result of the operation.
+static inline void nlab_ctrl_runtime_init(nlab_ctrl_runtime_opts opts, nlab_ctrl_error* ctrl_err) {
+    bool started = (opts.max_procs <= 0 || nlab_ctrl_runtime_start_env_("GOMAXPROCS") == opts.max_procs)
+        && (opts.gc_percent == 0 || nlab_ctrl_runtime_start_env_("GOGC") == opts.gc_percent)
+        && (opts.memory_limit <= 0 || nlab_ctrl_runtime_start_env_("GOMEMLIMIT") == opts.memory_limit);
+    bool reexecuted = getenv(NLAB_CTRL_RUNTIME_REEXEC_ENV) != NULL;
+    unsetenv(NLAB_CTRL_RUNTIME_REEXEC_ENV);
+    if (!started) {
+        if (reexecuted) {
+            nlab_ctrl_runtime_error_(ctrl_err, "runtime: settings not found in the environment after re-executing the process", NULL);
+        } else if (opts.reexec) {
+            nlab_ctrl_runtime_reexec_(&opts, ctrl_err);
+        } else {
+            nlab_ctrl_runtime_error_(ctrl_err, "runtime: settings must be present in the environment when the process starts", NULL);
+        }
+        return;
+    }
+
+    DIR* dir = opendir("/proc/self/task");
+    if (dir == NULL) {
+        nlab_ctrl_runtime_error_(ctrl_err, "runtime: failed to list threads", strerror(errno));
+        return;
+    }
+
+    int self = (int)syscall(SYS_gettid);
+    nlab_ctrl_runtime_state* st = &nlab_ctrl_runtime_state_;
+    st->tids_size = 0;
+
+    struct dirent* e;
+    while ((e = readdir(dir)) != NULL) {
+        int tid = atoi(e->d_name);
+        if (tid <= 0 || tid == self || st->tids_size == NLAB_CTRL_RUNTIME_MAX_THREADS) {
+            continue;
+        }
+        st->tids[st->tids_size++] = tid;
+
+        if (opts.cpus != NULL && nlab_ctrl_runtime_set_affinity_(tid, opts.cpus, opts.cpus_size) != 0 && errno != ESRCH) {
+            closedir(dir);
+            nlab_ctrl_runtime_error_(ctrl_err, "runtime: failed to set affinity", strerror(errno));
+            return;
+        }
+    }
+    closedir(dir);
+}
+
+/// \brief Pins the calling thread to a single cpu.
+///
+/// Intended for a dedicated service thread, that issues all calls to the controllers,
+/// so that runtime code entered through those calls stays on the given cpu.
+///
+/// \param[in]     cpu        The cpu the thread should run on.
+/// \param[in,out] ctrl_err   Used to communicate the result of the operation.
+static inline void nlab_ctrl_runtime_pin_service_thread(int cpu, nlab_ctrl_error* ctrl_err) {
+    if (nlab_ctrl_runtime_set_affinity_(0, &cpu, 1) != 0) {
+        nlab_ctrl_runtime_error_(ctrl_err, "runtime: failed to pin service thread", strerror(errno));
+    }
+}
+
+/// \brief Retrieves statistics about the runtime.
+///
+/// Only threads found by nlab_ctrl_runtime_init() are accounted.
+///
+/// \return The current runtime statistics.
+static inline nlab_ctrl_runtime_stats nlab_ctrl_runtime_get_stats() {
+    nlab_ctrl_runtime_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.max_procs    = (int)nlab_ctrl_runtime_start_env_("GOMAXPROCS");
+    stats.gc_percent   = (int)nlab_ctrl_runtime_start_env_("GOGC");
+    stats.memory_limit = nlab_ctrl_runtime_start_env_("GOMEMLIMIT");
+
+    long ticks = sysconf(_SC_CLK_TCK);
+    nlab_ctrl_runtime_state* st = &nlab_ctrl_runtime_state_;
+    for (int i = 0; i < st->tids_size; ++i) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/self/task/%d/stat", st->tids[i]);
+        size_t size = 0;
+        char* buf = nlab_ctrl_runtime_read_file_(path, &size);
+        if (buf == NULL) {
+            continue;
+        }
+
+        // utime and stime are fields 14 and 15, counted after the parenthesized command name.
+        unsigned long long utime = 0, stime = 0;
+        char* p = strrchr(buf, ')');
+        if (p != NULL && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) == 2) {
+            stats.threads++;
+            stats.cpu_time += (long long int)(utime + stime) * (1000000000LL / ticks);
+        }
+        free(buf);
+    }
+    return stats;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,245 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the layout of the state page and functions to read it.
+///
+/// A state page holds the latest known state of a controller in a fixed, versioned layout.
+/// It is published by the C++ nlab::ctrl::StatePage, either in process memory or in a shared memory object
+/// under /dev/shm, that other processes map read-only with nlab_ctrl_state_page_open(). \n
+/// The page is protected by a sequence lock: readers never block the writer and retry,
+/// if the page changed while they read it. Reads require no system calls and no allocations. \n
+/// If the writer died during an update, the page stays marked as written. Readers then stop waiting after
+/// ::NLAB_CTRL_STATE_PAGE_SPIN_LIMIT attempts and return the page as the writer left it,
+/// use nlab_ctrl_state_page_stalled() to detect this.
+///
+/// \code
+/// const nlab_ctrl_state_page* page = nlab_ctrl_state_page_open("/nlab-ctrl-dummy");
+/// nlab_ctrl_state_page_led led;
+/// if (page != NULL && nlab_ctrl_state_page_get_led(page, "led1", &led)) {
+///     printf("%d\n", led.brightness);
+/// }
+/// nlab_ctrl_state_page_close(page);
+/// \endcode
+///
+/// Link with -lrt on glibc older than 2.34.
+#ifndef NLAB_CTRL_LIB_STATEPAGE_H
+#define NLAB_CTRL_LIB_STATEPAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// \brief Identifies a state page, "NLSP".
+#define NLAB_CTRL_STATE_PAGE_MAGIC 0x50534c4e
+/// \brief The version of the layout. Readers must reject pages of another version.
+#define NLAB_CTRL_STATE_PAGE_VERSION 1
+/// \brief Maximum number of resources of each kind in a page.
+#define NLAB_CTRL_STATE_PAGE_MAX 16
+/// \brief Maximum length of a resource id, including the terminating NUL.
+#define NLAB_CTRL_STATE_PAGE_ID_SIZE 32
+/// \brief Number of attempts a reader waits for an update to finish, before it reads the page regardless.
+#ifndef NLAB_CTRL_STATE_PAGE_SPIN_LIMIT
+#define NLAB_CTRL_STATE_PAGE_SPIN_LIMIT (1 << 22)
+#endif
+
+/// \brief A step motor in a state page.
+typedef struct {
+    char    id[NLAB_CTRL_STATE_PAGE_ID_SIZE]; ///< The id of the step motor.
+    int32_t step;                             ///< The position of the step motor.
+    int32_t min_step;                         ///< The minimum position.
+    int32_t max_step;                         ///< The maximum position.
+} nlab_ctrl_state_page_step_motor;
+
+/// \brief A led in a state page.
+typedef struct {
+    char    id[NLAB_CTRL_STATE_PAGE_ID_SIZE]; ///< The id of the led.
+    uint8_t on;                               ///< The state of the led.
+    uint8_t strobe_on;                        ///< A flag whether strobe is active.
+    int32_t brightness;                       ///< The brightness of the led.
+    int32_t strobe_delay;                     ///< The delay of the strobe in milliseconds.
+} nlab_ctrl_state_page_led;
+
+/// \brief A switch in a state page.
+typedef struct {
+    char    id[NLAB_CTRL_STATE_PAGE_ID_SIZE]; ///< The id of the switch.
+    uint8_t on;                               ///< The state of the switch.
+} nlab_ctrl_state_page_switch;
+
+/// \brief A gpio pin in a state page.
+typedef struct {
+    char    id[NLAB_CTRL_STATE_PAGE_ID_SIZE]; ///< The id of the gpio pin.
+    uint8_t on;                               ///< The state of the gpio pin.
+    uint8_t direction;                        ///< The nlab_ctrl_gpio_pin_direction of the gpio pin.
+} nlab_ctrl_state_page_gpio_pin;
+
+/// \brief The layout of a state page.
+typedef struct {
+    uint32_t magic;          ///< Always ::NLAB_CTRL_STATE_PAGE_MAGIC.
+    uint32_t version;        ///< Always ::NLAB_CTRL_STATE_PAGE_VERSION.
+    uint32_t size;           ///< The size of this struct in bytes.
+    uint32_t seq;            ///< The sequence lock, odd while the page is written.
+    int64_t  updated_ns;     ///< The CLOCK_MONOTONIC time of the last update in nanoseconds.
+
+    float    temperature;    ///< The last known temperature.
+    uint8_t  status_led;     ///< The last nlab_ctrl_status_led_state set.
+    uint8_t  gpio_enabled;   ///< A flag whether the gpio pins are enabled.
+
+    uint32_t n_step_motors;  ///< Number of valid entries in step_motors.
+    uint32_t n_leds;         ///< Number of valid entries in leds.
+    uint32_t n_switches;     ///< Number of valid entries in switches.
+    uint32_t n_gpio_pins;    ///< Number of valid entries in gpio_pins.
+
+    nlab_ctrl_state_page_step_motor step_motors[NLAB_CTRL_STATE_PAGE_MAX]; ///< The step motors.
+    nlab_ctrl_state_page_led        leds[NLAB_CTRL_STATE_PAGE_MAX];        ///< The leds.
+    nlab_ctrl_state_page_switch     switches[NLAB_CTRL_STATE_PAGE_MAX];    ///< The switches.
+    nlab_ctrl_state_page_gpio_pin   gpio_pins[NLAB_CTRL_STATE_PAGE_MAX];   ///< The gpio pins.
+} nlab_ctrl_state_page;
+
+//################//
+//### Internal ###//
+//################//
+
+static inline void nlab_ctrl_state_page_relax_(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Waits until no update is in progress. Gives up after NLAB_CTRL_STATE_PAGE_SPIN_LIMIT attempts,
+// so that a writer, that died during an update, does not block the reader forever.
+static inline uint32_t nlab_ctrl_state_page_begin_(const nlab_ctrl_state_page* page) {
+    uint32_t seq;
+    for (long i = 0; ((seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE)) & 1) && i < NLAB_CTRL_STATE_PAGE_SPIN_LIMIT; ++i) {
+        nlab_ctrl_state_page_relax_();
+    }
+    return seq;
+}
+
+static inline bool nlab_ctrl_state_page_retry_(const nlab_ctrl_state_page* page, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&page->seq, __ATOMIC_RELAXED) != seq;
+}
+
+//###########//
+//### API ###//
+//###########//
+
+/// \brief Maps a state page published in shared memory read-only.
+///
+/// \param[in]  name  The name of the shared memory object, as passed to the StatePage, e.g. "/nlab-ctrl-dummy".
+///
+/// \return The page, or NULL, if it does not exist, is too small or has another version.
+static inline const nlab_ctrl_state_page* nlab_ctrl_state_page_open(const char* name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    // Accessing the mapping beyond the end of the object raises SIGBUS, e.g. while the writer still sizes it.
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(nlab_ctrl_state_page)) {
+        close(fd);
+        return NULL;
+    }
+    void* p = mmap(NULL, sizeof(nlab_ctrl_state_page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    const nlab_ctrl_state_page* page = (const nlab_ctrl_state_page*)p;
+    if (page->magic != NLAB_CTRL_STATE_PAGE_MAGIC || page->version != NLAB_CTRL_STATE_PAGE_VERSION ||
+        page->size != sizeof(nlab_ctrl_state_page)) {
+        munmap(p, sizeof(nlab_ctrl_state_page));
+        return NULL;
+    }
+    return page;
+}
+
+/// \brief Unmaps a state page returned by nlab_ctrl_state_page_open(). page may be NULL.
+static inline void nlab_ctrl_state_page_close(const nlab_ctrl_state_page* page) {
+    if (page != NULL) {
+        munmap((void*)page, sizeof(nlab_ctrl_state_page));
+    }
+}
+
+/// \brief Returns true, if an update is in progress. If this stays true, the writer died during an update
+/// and the content of the page may be inconsistent.
+static inline bool nlab_ctrl_state_page_stalled(const nlab_ctrl_state_page* page) {
+    return __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE) & 1;
+}
+
+/// \brief Copies a consistent snapshot of the whole page.
+static inline void nlab_ctrl_state_page_read(const nlab_ctrl_state_page* page, nlab_ctrl_state_page* out) {
+    uint32_t seq;
+    do {
+        seq = nlab_ctrl_state_page_begin_(page);
+        memcpy(out, page, sizeof(nlab_ctrl_state_page));
+    } while (nlab_ctrl_state_page_retry_(page, seq));
+}
+
+/// \brief Returns the last known temperature.
+static inline float nlab_ctrl_state_page_temperature(const nlab_ctrl_state_page* page) {
+    uint32_t seq;
+    float t;
+    do {
+        seq = nlab_ctrl_state_page_begin_(page);
+        t = page->temperature;
+    } while (nlab_ctrl_state_page_retry_(page, seq));
+    return t;
+}
+
+// Defines a function that copies the entry with the given id of one resource list.
+#define NLAB_CTRL_STATE_PAGE_GET_(kind, list, n)                                                                   \
+    static inline bool nlab_ctrl_state_page_get_##kind(const nlab_ctrl_state_page* page, const char* id,          \
+                                                       nlab_ctrl_state_page_##kind* out) {                        \
+        uint32_t seq;                                                                                             \
+        bool found;                                                                                               \
+        do {                                                                                                      \
+            seq = nlab_ctrl_state_page_begin_(page);                                                              \
+            found = false;                                                                                        \
+            uint32_t count = page->n < NLAB_CTRL_STATE_PAGE_MAX ? page->n : NLAB_CTRL_STATE_PAGE_MAX;             \
+            for (uint32_t i = 0; i < count; ++i) {                                                                \
+                if (strncmp(page->list[i].id, id, NLAB_CTRL_STATE_PAGE_ID_SIZE) == 0) {                           \
+                    *out = page->list[i];                                                                         \
+                    found = true;                                                                                 \
+                    break;                                                                                        \
+                }                                                                                                 \
+            }                                                                                                     \
+        } while (nlab_ctrl_state_page_retry_(page, seq));                                                         \
+        return found;                                                                                             \
+    }
+
+/// \fn bool nlab_ctrl_state_page_get_step_motor(const nlab_ctrl_state_page* page, const char* id, nlab_ctrl_state_page_step_motor* out)
+/// \brief Copies the step motor with the given id. Returns false, if the page holds no such step motor.
+NLAB_CTRL_STATE_PAGE_GET_(step_motor, step_motors, n_step_motors)
+/// \fn bool nlab_ctrl_state_page_get_led(const nlab_ctrl_state_page* page, const char* id, nlab_ctrl_state_page_led* out)
+/// \brief Copies the led with the given id. Returns false, if the page holds no such led.
+NLAB_CTRL_STATE_PAGE_GET_(led, leds, n_leds)
+/// \fn bool nlab_ctrl_state_page_get_switch(const nlab_ctrl_state_page* page, const char* id, nlab_ctrl_state_page_switch* out)
+/// \brief Copies the switch with the given id. Returns false, if the page holds no such switch.
+NLAB_CTRL_STATE_PAGE_GET_(switch, switches, n_switches)
+/// \fn bool nlab_ctrl_state_page_get_gpio_pin(const nlab_ctrl_state_page* page, const char* id, nlab_ctrl_state_page_gpio_pin* out)
+/// \brief Copies the gpio pin with the given id. Returns false, if the page holds no such gpio pin.
+NLAB_CTRL_STATE_PAGE_GET_(gpio_pin, gpio_pins, n_gpio_pins)
+
+#undef NLAB_CTRL_STATE_PAGE_GET_
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,321 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the StatePage, that publishes the latest known state of a controller to a memory page.
+///
+/// Every call through the StatePage updates a fixed-layout nlab_ctrl_state_page, defined in libnlab-ctrl-statepage.h,
+/// with the values read or written. Monitoring code reads the page directly with the functions of that header,
+/// without calls into the controller, system calls or allocations. \n
+/// The page lives in process memory or, if a name is given, in a shared memory object under /dev/shm,
+/// so that other processes can map it read-only.
+#ifndef NLAB_CTRL_LIB_STATEPAGE_HPP
+#define NLAB_CTRL_LIB_STATEPAGE_HPP
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <libnlab-ctrl.hpp>
+#include <libnlab-ctrl-forward.hpp>
+#include <libnlab-ctrl-statepage.h>
+
+namespace nlab::ctrl {
+
+/// \brief A Controller that publishes the state it reads and writes to a nlab_ctrl_state_page.
+///
+/// Only the first ::NLAB_CTRL_STATE_PAGE_MAX resources of each kind, whose ids are shorter than
+/// ::NLAB_CTRL_STATE_PAGE_ID_SIZE, are published. \n
+/// The position of a step motor is read back from the controller after every move, and the complete state
+/// after powerReset(), since the controller decides where a move ends and what a reset restores.
+/// If that read fails, the page keeps the previous values until the next successful read.
+class StatePage : public ForwardingController {
+public:
+    /// \brief Opens a controller, wraps it and reads its complete state into the page.
+    ///
+    /// \param[in]  shmName  The name of the shared memory object, e.g. "/nlab-ctrl-dummy". If empty, the page is private to the process.
+    ///
+    /// \throws Exception
+    static std::shared_ptr<StatePage> open(const std::string& backendID, const std::string& devPath,
+                                           const ControllerOpts& opts, const std::string& shmName = std::string()) {
+        auto sp = std::make_shared<StatePage>(Controller::open(backendID, devPath, opts), shmName);
+        sp->refresh();
+        return sp;
+    }
+
+    /// \brief Wraps the controller inner and creates an empty page.
+    ///
+    /// An existing shared memory object with the same name is replaced.
+    ///
+    /// \throws Exception  If the page could not be created.
+    StatePage(Controller::Ptr inner, const std::string& shmName = std::string()) : ForwardingController(inner), shmName_(shmName) {
+        void* p;
+        if (shmName_.empty()) {
+            p = mmap(nullptr, sizeof(nlab_ctrl_state_page), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        } else {
+            shm_unlink(shmName_.c_str());
+            int fd = shm_open(shmName_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+            if (fd < 0) {
+                throw Exception(Exception::Generic, "statepage: failed to create " + shmName_);
+            }
+            if (ftruncate(fd, sizeof(nlab_ctrl_state_page)) != 0) {
+                ::close(fd);
+                shm_unlink(shmName_.c_str());
+                throw Exception(Exception::Generic, "statepage: failed to size " + shmName_);
+            }
+            p = mmap(nullptr, sizeof(nlab_ctrl_state_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+        }
+        if (p == MAP_FAILED) {
+            if (!shmName_.empty()) {
+                shm_unlink(shmName_.c_str());
+            }
+            throw Exception(Exception::Generic, "statepage: failed to map the page");
+        }
+
+        page_ = static_cast<nlab_ctrl_state_page*>(p);
+        page_->version = NLAB_CTRL_STATE_PAGE_VERSION;
+        page_->size = sizeof(nlab_ctrl_state_page);
+        page_->gpio_enabled = inner_->gpioPinsEnabled();
+        // Readers check the magic first, so it is published last.
+        __atomic_store_n(&page_->magic, NLAB_CTRL_STATE_PAGE_MAGIC, __ATOMIC_RELEASE);
+    }
+
+    /// \brief Unmaps the page and removes its shared memory object.
+    ~StatePage() {
+        munmap(page_, sizeof(nlab_ctrl_state_page));
+        if (!shmName_.empty()) {
+            shm_unlink(shmName_.c_str());
+        }
+    }
+
+    StatePage(const StatePage&) = delete;
+    StatePage& operator=(const StatePage&) = delete;
+
+    /// \brief Returns the page. Read it with the functions of libnlab-ctrl-statepage.h.
+    const nlab_ctrl_state_page* page() const noexcept { return page_; }
+
+    /// \brief Reads all resources and the temperature of the controller into the page.
+    ///
+    /// \throws Exception
+    void refresh() {
+        getStepMotors();
+        getLEDs();
+        getSwitches();
+        if (inner_->gpioPinsEnabled()) {
+            getGPIOPins();
+        }
+        temperature();
+    }
+
+    //###############//
+    //### Getters ###//
+    //###############//
+
+    std::vector<StepMotor> getStepMotors() override {
+        std::vector<StepMotor> sms = inner_->getStepMotors();
+        update([&](nlab_ctrl_state_page& p) { for (const StepMotor& sm : sms) publish(p, sm); });
+        return sms;
+    }
+    StepMotor getStepMotor(const std::string& id) override {
+        StepMotor sm = inner_->getStepMotor(id);
+        update([&](nlab_ctrl_state_page& p) { publish(p, sm); });
+        return sm;
+    }
+    std::vector<LED> getLEDs() override {
+        std::vector<LED> leds = inner_->getLEDs();
+        update([&](nlab_ctrl_state_page& p) { for (const LED& l : leds) publish(p, l); });
+        return leds;
+    }
+    LED getLED(const std::string& id) override {
+        LED l = inner_->getLED(id);
+        update([&](nlab_ctrl_state_page& p) { publish(p, l); });
+        return l;
+    }
+    std::vector<Switch> getSwitches() override {
+        std::vector<Switch> sws = inner_->getSwitches();
+        update([&](nlab_ctrl_state_page& p) { for (const Switch& sw : sws) publish(p, sw); });
+        return sws;
+    }
+    Switch getSwitch(const std::string& id) override {
+        Switch sw = inner_->getSwitch(id);
+        update([&](nlab_ctrl_state_page& p) { publish(p, sw); });
+        return sw;
+    }
+    std::vector<GPIOPin> getGPIOPins() override {
+        std::vector<GPIOPin> gps = inner_->getGPIOPins();
+        update([&](nlab_ctrl_state_page& p) { for (const GPIOPin& gp : gps) publish(p, gp); });
+        return gps;
+    }
+    GPIOPin getGPIOPin(const std::string& id) override {
+        GPIOPin gp = inner_->getGPIOPin(id);
+        update([&](nlab_ctrl_state_page& p) { publish(p, gp); });
+        return gp;
+    }
+    float temperature() override {
+        float t = inner_->temperature();
+        update([&](nlab_ctrl_state_page& p) { p.temperature = t; });
+        return t;
+    }
+
+    //###############//
+    //### Setters ###//
+    //###############//
+
+    void setStepMotorRelPos(const std::string& id, int step) override {
+        inner_->setStepMotorRelPos(id, step);
+        reread(id);
+    }
+    void setStepMotorAbsPos(const std::string& id, int step) override {
+        inner_->setStepMotorAbsPos(id, step);
+        reread(id);
+    }
+    void setStatusLED(StatusLEDState state) override {
+        inner_->setStatusLED(state);
+        update([&](nlab_ctrl_state_page& p) { p.status_led = static_cast<uint8_t>(state); });
+    }
+    void setLED(const std::string& id, bool on) override {
+        inner_->setLED(id, on);
+        modify(&nlab_ctrl_state_page::leds, &nlab_ctrl_state_page::n_leds, id, [&](nlab_ctrl_state_page_led& e) { e.on = on; });
+    }
+    void setLEDStrobe(const std::string& id, bool on) override {
+        inner_->setLEDStrobe(id, on);
+        modify(&nlab_ctrl_state_page::leds, &nlab_ctrl_state_page::n_leds, id, [&](nlab_ctrl_state_page_led& e) { e.strobe_on = on; });
+    }
+    void setLEDBrightness(const std::string& id, int brightness) override {
+        inner_->setLEDBrightness(id, brightness);
+        modify(&nlab_ctrl_state_page::leds, &nlab_ctrl_state_page::n_leds, id, [&](nlab_ctrl_state_page_led& e) { e.brightness = brightness; });
+    }
+    void setLEDStrobeDelay(const std::string& id, int delay) override {
+        inner_->setLEDStrobeDelay(id, delay);
+        modify(&nlab_ctrl_state_page::leds, &nlab_ctrl_state_page::n_leds, id, [&](nlab_ctrl_state_page_led& e) { e.strobe_delay = delay; });
+    }
+    void setSwitch(const std::string& id, bool on) override {
+        inner_->setSwitch(id, on);
+        modify(&nlab_ctrl_state_page::switches, &nlab_ctrl_state_page::n_switches, id, [&](nlab_ctrl_state_page_switch& e) { e.on = on; });
+    }
+    void setGPIOPin(const std::string& id, bool on) override {
+        inner_->setGPIOPin(id, on);
+        modify(&nlab_ctrl_state_page::gpio_pins, &nlab_ctrl_state_page::n_gpio_pins, id, [&](nlab_ctrl_state_page_gpio_pin& e) { e.on = on; });
+    }
+    void enableGPIOPins() override {
+        inner_->enableGPIOPins();
+        update([&](nlab_ctrl_state_page& p) { p.gpio_enabled = 1; });
+    }
+    void disableGPIOPins() override {
+        inner_->disableGPIOPins();
+        update([&](nlab_ctrl_state_page& p) { p.gpio_enabled = 0; });
+    }
+    void powerReset() override {
+        inner_->powerReset();
+        try {
+            refresh();
+        } catch (Exception&) {
+            // The reset succeeded, the page catches up with the next read.
+        }
+    }
+
+private:
+    // Publishes the position the step motor reached. A failed read does not fail the move, that already happened.
+    void reread(const std::string& id) {
+        try {
+            getStepMotor(id);
+        } catch (Exception&) {
+        }
+    }
+
+    // Writes the page under the sequence lock: the sequence is odd while fn runs.
+    template<typename F>
+    void update(F fn) {
+        std::lock_guard<std::mutex> lock(mx_);
+        uint32_t seq = page_->seq;
+        __atomic_store_n(&page_->seq, seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        fn(*page_);
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        page_->updated_ns = static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+
+        __atomic_store_n(&page_->seq, seq + 2, __ATOMIC_RELEASE);
+    }
+
+    // Modifies the entry with the given id, if it is published.
+    template<typename E, typename F>
+    void modify(E (nlab_ctrl_state_page::*list)[NLAB_CTRL_STATE_PAGE_MAX], uint32_t nlab_ctrl_state_page::*n, const std::string& id, F fn) {
+        update([&](nlab_ctrl_state_page& p) {
+            for (uint32_t i = 0; i < p.*n; ++i) {
+                if (id == (p.*list)[i].id) {
+                    fn((p.*list)[i]);
+                    return;
+                }
+            }
+        });
+    }
+
+    // Returns the entry with the given id, adding it if necessary, or nullptr, if it cannot be published.
+    template<typename E>
+    static E* entry(E* list, uint32_t& n, const std::string& id) {
+        if (id.size() >= NLAB_CTRL_STATE_PAGE_ID_SIZE) {
+            return nullptr;
+        }
+        for (uint32_t i = 0; i < n; ++i) {
+            if (id == list[i].id) {
+                return &list[i];
+            }
+        }
+        if (n == NLAB_CTRL_STATE_PAGE_MAX) {
+            return nullptr;
+        }
+        E* e = &list[n++];
+        std::memset(e, 0, sizeof(E));
+        std::memcpy(e->id, id.c_str(), id.size() + 1);
+        return e;
+    }
+
+    static void publish(nlab_ctrl_state_page& p, const StepMotor& sm) {
+        if (auto e = entry(p.step_motors, p.n_step_motors, sm.id)) {
+            e->step = sm.step;
+            e->min_step = sm.minStep;
+            e->max_step = sm.maxStep;
+        }
+    }
+    static void publish(nlab_ctrl_state_page& p, const LED& l) {
+        if (auto e = entry(p.leds, p.n_leds, l.id)) {
+            e->on = l.on;
+            e->strobe_on = l.strobeOn;
+            e->brightness = l.brightness;
+            e->strobe_delay = l.strobeDelay;
+        }
+    }
+    static void publish(nlab_ctrl_state_page& p, const Switch& sw) {
+        if (auto e = entry(p.switches, p.n_switches, sw.id)) {
+            e->on = sw.on;
+        }
+    }
+    static void publish(nlab_ctrl_state_page& p, const GPIOPin& gp) {
+        if (auto e = entry(p.gpio_pins, p.n_gpio_pins, gp.id)) {
+            e->on = gp.on;
+            e->direction = static_cast<uint8_t>(gp.direction);
+        }
+    }
+
+    const std::string     shmName_;
+    nlab_ctrl_state_page* page_ = nullptr;
+    std::mutex            mx_;
+};
+
+}
+
+#endif
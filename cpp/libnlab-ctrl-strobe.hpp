@@ -0,0 +1,304 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the StrobeTrigger, that fires leds synchronised to a trigger.
+///
+/// Controller::setLEDStrobe() and Controller::setLEDStrobeDelay() configure strobes that run freely on the controller.
+/// The StrobeTrigger instead fires a set of leds for a given duration after a programmable delay,
+/// whenever an edge is seen on a gpio input, for example the exposure output of a camera, or fire() is called.
+/// Each fire is reported with its timestamps, measured around the controller calls that switched the leds.
+///
+/// The trigger input is polled and the leds are switched with regular controller calls, each a round trip over
+/// the serial link, so the timing is only as precise as that link: it is not meant for low-jitter triggering.
+/// Every fire costs one Controller::setLED() call per led to switch it on and, unless StrobeOpts::duration is 0,
+/// one more to switch it off, and the controller persists the led state on every call.
+/// Use the strobe of the controller for exposures, that need precise or frequent flashes.
+#ifndef NLAB_CTRL_LIB_STROBE_HPP
+#define NLAB_CTRL_LIB_STROBE_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <libnlab-ctrl.hpp>
+
+namespace nlab::ctrl {
+
+/// \brief The edge of the trigger input that fires a StrobeTrigger.
+enum TriggerEdge {
+    Rising  = 0, ///< The input switches on.
+    Falling = 1, ///< The input switches off.
+    Both    = 2  ///< The input changes its state.
+};
+
+/// \brief Options for a StrobeTrigger.
+///
+/// For every member that is not set a sensible default value is used. This means that an empty struct represents default options.
+struct StrobeOpts {
+    /// \brief The ids of the leds to fire.
+    std::vector<std::string> leds;
+
+    /// \brief The id of the gpio input to watch. Defaults to none, which fires only on StrobeTrigger::fire().
+    ///
+    /// The gpio pins must be enabled with Controller::enableGPIOPins().
+    std::string triggerPin;
+
+    /// \brief The edge of triggerPin that fires. Defaults to TriggerEdge::Rising.
+    TriggerEdge edge = Rising;
+
+    /// \brief Delay between the trigger and switching the leds on. Defaults to 0.
+    std::chrono::microseconds delay = std::chrono::microseconds(0);
+
+    /// \brief Time the leds stay on. Defaults to 1 millisecond.
+    ///
+    /// If 0, the leds are left on. The leds stay on at least for the duration of the setLED() calls.
+    std::chrono::microseconds duration = std::chrono::microseconds(1000);
+
+    /// \brief Interval in which triggerPin is read. Defaults to 10 milliseconds.
+    ///
+    /// Every read is a getGPIOPin() round trip over the serial link, shorter intervals saturate the link.
+    /// A pulse on triggerPin is only detected reliably, if it lasts longer than poll plus the duration of a read,
+    /// shorter pulses may be missed. An edge is detected up to the same time late.
+    /// The input is not read while a fire is in progress, from the trigger until the leds are switched off,
+    /// which takes delay plus duration plus the setLED() calls: pulses within that time are missed
+    /// and other edges are detected only after the fire.
+    std::chrono::microseconds poll = std::chrono::milliseconds(10);
+
+    /// \brief Time before a deadline, from which the worker spins instead of sleeping. Defaults to 0.
+    ///
+    /// Spinning only makes the controller call start closer to the deadline, at the cost of cpu time.
+    /// The time the leds switch is still dominated by the round trip over the serial link.
+    std::chrono::microseconds spin = std::chrono::microseconds(0);
+
+    /// \brief The cpu the worker thread is pinned to. Defaults to -1, which leaves it unpinned.
+    int cpu = -1;
+};
+
+/// \brief Reports a single fire of a StrobeTrigger.
+///
+/// All timestamps are taken from std::chrono::steady_clock on the host.
+struct StrobeEvent {
+    uint64_t                              sequence; ///< Number of the fire, starting at 1.
+    std::chrono::steady_clock::time_point trigger;  ///< The time of the trigger.
+    std::chrono::steady_clock::time_point fire;     ///< The time the leds were switched on, the middle of the calls.
+    std::chrono::nanoseconds              late;     ///< Difference of fire to the requested time, trigger + delay.
+    std::chrono::nanoseconds              uncertainty; ///< Duration of the calls that switched the leds on.
+    bool                                  ok;       ///< False, if a controller call failed.
+    std::string                           error;    ///< The message of the failure, if not ok.
+};
+
+/// \brief Fires leds after a trigger on a dedicated worker thread.
+class StrobeTrigger {
+public:
+    /// \brief Called from the worker thread after every fire.
+    typedef std::function<void(const StrobeEvent&)> EventFunc;
+
+    /// \brief Creates a trigger and starts its worker thread.
+    ///
+    /// \param[in]  ctrl     The controller.
+    /// \param[in]  opts     Optional parameters of the trigger.
+    /// \param[in]  onEvent  Optional callback receiving every StrobeEvent.
+    ///
+    /// \throws Exception  If the worker could not be pinned to StrobeOpts::cpu.
+    StrobeTrigger(Controller::Ptr ctrl, const StrobeOpts& opts = StrobeOpts(), EventFunc onEvent = nullptr)
+        : ctrl_(ctrl), opts_(opts), onEvent_(onEvent) {
+        worker_ = std::thread([this] { run(); });
+
+        if (opts_.cpu >= 0) {
+            int err = EINVAL;
+            if (opts_.cpu < CPU_SETSIZE) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(opts_.cpu, &set);
+                err = pthread_setaffinity_np(worker_.native_handle(), sizeof(set), &set);
+            }
+            if (err != 0) {
+                stop();
+                throw Exception(Exception::Generic, "strobe: failed to pin worker to cpu " + std::to_string(opts_.cpu) +
+                                                    ": " + std::strerror(err));
+            }
+        }
+    }
+
+    /// \brief Stops the worker thread. Pending triggers are dropped.
+    ///
+    /// A fire in progress is cut short: its leds are switched off right away.
+    ~StrobeTrigger() {
+        stop();
+    }
+
+    StrobeTrigger(const StrobeTrigger&) = delete;
+    StrobeTrigger& operator=(const StrobeTrigger&) = delete;
+
+    /// \brief Triggers a fire now, as if an edge was seen on the trigger input.
+    void fire() {
+        fire(std::chrono::steady_clock::now());
+    }
+
+    /// \brief Triggers a fire with the given trigger time.
+    ///
+    /// The leds are switched on at trigger + StrobeOpts::delay, or as soon as possible, if that lies in the past.
+    void fire(std::chrono::steady_clock::time_point trigger) {
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            pending_.push_back(trigger);
+        }
+        cv_.notify_all();
+    }
+
+    /// \brief Returns the number of fires so far.
+    uint64_t fires() {
+        std::lock_guard<std::mutex> lock(mx_);
+        return sequence_;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    void stop() noexcept {
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            stopped_ = true;
+        }
+        cv_.notify_all();
+        worker_.join();
+    }
+
+    void run() {
+        bool watch = !opts_.triggerPin.empty();
+        bool last = false;
+        bool known = false;
+        auto nextPoll = Clock::now();
+
+        std::unique_lock<std::mutex> lock(mx_);
+        while (!stopped_) {
+            if (!pending_.empty()) {
+                Clock::time_point trigger = pending_.front();
+                pending_.pop_front();
+                lock.unlock();
+                strobe(trigger);
+                lock.lock();
+                continue;
+            }
+
+            if (!watch) {
+                cv_.wait(lock, [this] { return stopped_ || !pending_.empty(); });
+                continue;
+            }
+            if (cv_.wait_until(lock, nextPoll, [this] { return stopped_ || !pending_.empty(); })) {
+                continue;
+            }
+
+            // Read the trigger input and take the middle of the call as the time of an edge.
+            lock.unlock();
+            nextPoll = Clock::now() + opts_.poll;
+            Clock::time_point start = Clock::now();
+            bool on = last;
+            bool ok = true;
+            try {
+                on = ctrl_->getGPIOPin(opts_.triggerPin).on;
+            } catch (Exception&) {
+                ok = false;
+            }
+            Clock::time_point end = Clock::now();
+            lock.lock();
+
+            if (!ok) {
+                continue;
+            }
+            if (known && on != last &&
+                (opts_.edge == Both || (opts_.edge == Rising) == on)) {
+                pending_.push_back(start + (end - start) / 2);
+            }
+            last = on;
+            known = true;
+        }
+    }
+
+    void strobe(Clock::time_point trigger) {
+        StrobeEvent ev;
+        ev.trigger = trigger;
+        ev.ok = true;
+
+        Clock::time_point at = trigger + opts_.delay;
+        if (!waitUntil(at)) {
+            return;
+        }
+
+        Clock::time_point start = Clock::now();
+        set(true, ev);
+        Clock::time_point end = Clock::now();
+        ev.fire = start + (end - start) / 2;
+        ev.late = ev.fire - at;
+        ev.uncertainty = end - start;
+
+        if (opts_.duration.count() > 0) {
+            waitUntil(ev.fire + opts_.duration);
+            set(false, ev);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            ev.sequence = ++sequence_;
+        }
+        if (onEvent_) {
+            onEvent_(ev);
+        }
+    }
+
+    void set(bool on, StrobeEvent& ev) {
+        for (const std::string& id : opts_.leds) {
+            try {
+                ctrl_->setLED(id, on);
+            } catch (Exception& e) {
+                if (ev.ok) {
+                    ev.ok = false;
+                    ev.error = e.what();
+                }
+            }
+        }
+    }
+
+    // Sleeps until shortly before the deadline and spins for the rest.
+    // Returns false, if the trigger was stopped before the deadline.
+    bool waitUntil(Clock::time_point deadline) {
+        {
+            std::unique_lock<std::mutex> lock(mx_);
+            if (cv_.wait_until(lock, deadline - opts_.spin, [this] { return stopped_; })) {
+                return false;
+            }
+        }
+        while (Clock::now() < deadline) {
+        }
+        return true;
+    }
+
+    Controller::Ptr               ctrl_;
+    const StrobeOpts              opts_;
+    EventFunc                     onEvent_;
+    std::deque<Clock::time_point> pending_;
+    uint64_t                      sequence_ = 0;
+    bool                          stopped_  = false;
+    std::mutex                    mx_;
+    std::condition_variable       cv_;
+    std::thread                   worker_;
+};
+
+}
+
+#endif
@@ -0,0 +1,520 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the SupervisedController, that reconnects a lost controller and replays its state.
+///
+/// If a serial controller drops off the bus, every call of its Controller fails until it is closed and opened again.
+/// The SupervisedController detects this with a heartbeat, reopens the controller with backoff in the background
+/// and replays the last known state of all leds, switches and gpio pins once the controller is back.
+#ifndef NLAB_CTRL_LIB_SUPERVISOR_HPP
+#define NLAB_CTRL_LIB_SUPERVISOR_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <optional>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+
+#include <libnlab-ctrl-forward.hpp>
+
+namespace nlab::ctrl {
+
+/// \brief Options for a SupervisedController.
+///
+/// For every member that is not set a sensible default value is used. This means that an empty struct represents default options.
+struct SupervisorOpts {
+    /// \brief Interval of the liveness probe, while the controller is connected. Defaults to 1 second.
+    std::chrono::milliseconds heartbeat = std::chrono::milliseconds(1000);
+
+    /// \brief Delay before the first reconnect attempt. It doubles with every failed attempt. Defaults to 100 milliseconds.
+    std::chrono::milliseconds minBackoff = std::chrono::milliseconds(100);
+
+    /// \brief Maximum delay between reconnect attempts. Defaults to 5 seconds.
+    std::chrono::milliseconds maxBackoff = std::chrono::milliseconds(5000);
+
+    /// \brief Records setter calls made while disconnected and applies them after the reconnect. Defaults to false.
+    ///
+    /// If false, every call made while disconnected fails immediately.
+    /// Getters always fail immediately while disconnected.
+    bool buffer = false;
+
+    /// \brief The liveness probe. Must throw, if the controller is not reachable. Defaults to Controller::getLEDs().
+    std::function<void(Controller&)> probe;
+
+    /// \brief Called from the supervisor thread, whenever the connection is lost or restored.
+    std::function<void(bool connected)> onConnectionChange;
+
+    /// \brief Called from the supervisor thread for every recorded call, that the new connection rejected on replay.
+    ///
+    /// Such a call, e.g. a buffered setter with an unknown id, is dropped from the state,
+    /// so that it does not prevent the reconnect. call names the method and the id.
+    std::function<void(const std::string& call, const Exception& e)> onDropped;
+};
+
+/// \brief Counters of a SupervisedController.
+struct SupervisorStats {
+    long long int disconnects; ///< Number of detected connection losses.
+    long long int reconnects;  ///< Number of successful reconnects.
+    long long int attempts;    ///< Number of reconnect attempts.
+    long long int buffered;    ///< Number of setter calls recorded while disconnected.
+    long long int dropped;     ///< Number of recorded calls dropped, because the controller rejected them on replay.
+};
+
+/// \brief A Controller that survives the loss of the connection to its device.
+///
+/// Setters that succeed are recorded as the last known state. After a reconnect, the state is applied
+/// to the new connection in one pass, before any other call is let through. \n
+/// Step motors are not moved on replay, as they keep their physical position while disconnected.
+/// Only moves buffered while disconnected are applied, each exactly once. \n
+/// Recorded calls the controller rejects on replay are dropped and reported with SupervisorOpts::onDropped.
+class SupervisedController : public ForwardingController {
+public:
+    /// \brief Opens the controller.
+    typedef std::function<Controller::Ptr()> Opener;
+
+    /// \brief Static factory method that opens a controller and supervises its connection.
+    ///
+    /// \param[in]  backendID  The id of the backend to use.
+    /// \param[in]  devPath    The device path on the host.
+    /// \param[in]  opts       Optional parameters of the controller.
+    /// \param[in]  sopts      Optional parameters of the supervision.
+    ///
+    /// \return A Ptr to a Controller ready to use.
+    /// \throws Exception  If the first open fails.
+    static Ptr open(const std::string& backendID, const std::string& devPath, const ControllerOpts& opts,
+                    const SupervisorOpts& sopts = SupervisorOpts()) {
+        return std::make_shared<SupervisedController>([=] { return Controller::open(backendID, devPath, opts); }, sopts);
+    }
+
+    /// \brief Opens a controller with opener and supervises its connection.
+    ///
+    /// \throws Exception  If the first open fails.
+    SupervisedController(Opener opener, const SupervisorOpts& opts = SupervisorOpts())
+        : ForwardingController(opener()), opener_(opener), opts_(opts) {
+        if (!opts_.probe) {
+            opts_.probe = [](Controller& c) { c.getLEDs(); };
+        }
+        worker_ = std::thread([this] { run(); });
+    }
+
+    /// \brief Stops the supervision and closes the controller.
+    ~SupervisedController() {
+        close();
+    }
+
+    /// \brief Returns true, while the controller is connected.
+    bool connected() {
+        std::lock_guard<std::mutex> lock(mx_);
+        return up_;
+    }
+
+    /// \brief Returns the counters of the supervision.
+    SupervisorStats stats() {
+        std::lock_guard<std::mutex> lock(mx_);
+        return stats_;
+    }
+
+    std::vector<StepMotor> getStepMotors() override { return get([&](Controller& c) { return c.getStepMotors(); }); }
+    StepMotor getStepMotor(const std::string& id) override { return get([&](Controller& c) { return c.getStepMotor(id); }); }
+
+    void setStepMotorRelPos(const std::string& id, int step) override {
+        set([&](Controller& c) { c.setStepMotorRelPos(id, step); }, nullptr, [&] {
+            auto& m = state_.moves[id];
+            m.second += step;
+        });
+    }
+
+    void setStepMotorAbsPos(const std::string& id, int step) override {
+        set([&](Controller& c) { c.setStepMotorAbsPos(id, step); }, nullptr, [&] {
+            state_.moves[id] = {true, step};
+        });
+    }
+
+    void setStatusLED(StatusLEDState state) override {
+        set([&](Controller& c) { c.setStatusLED(state); }, [&] { state_.statusLED = state; });
+    }
+
+    void setStatusLEDBlinkingDuration(long long int duration) override {
+        set([&](Controller& c) { c.setStatusLEDBlinkingDuration(duration); }, [&] { state_.blinkingDuration = duration; });
+    }
+
+    std::vector<LED> getLEDs() override { return get([&](Controller& c) { return c.getLEDs(); }); }
+    LED getLED(const std::string& id) override { return get([&](Controller& c) { return c.getLED(id); }); }
+
+    void setLED(const std::string& id, bool on) override {
+        set([&](Controller& c) { c.setLED(id, on); }, [&] { state_.leds[id].on = on; });
+    }
+
+    void setLEDStrobe(const std::string& id, bool on) override {
+        set([&](Controller& c) { c.setLEDStrobe(id, on); }, [&] { state_.leds[id].strobeOn = on; });
+    }
+
+    void setLEDBrightness(const std::string& id, int brightness) override {
+        set([&](Controller& c) { c.setLEDBrightness(id, brightness); }, [&] { state_.leds[id].brightness = brightness; });
+    }
+
+    void setLEDStrobeDelay(const std::string& id, int delay) override {
+        set([&](Controller& c) { c.setLEDStrobeDelay(id, delay); }, [&] { state_.leds[id].strobeDelay = delay; });
+    }
+
+    std::vector<Switch> getSwitches() override { return get([&](Controller& c) { return c.getSwitches(); }); }
+    Switch getSwitch(const std::string& id) override { return get([&](Controller& c) { return c.getSwitch(id); }); }
+
+    void setSwitch(const std::string& id, bool on) override {
+        set([&](Controller& c) { c.setSwitch(id, on); }, [&] { state_.switches[id] = on; });
+    }
+
+    void enableGPIOPins() override {
+        set([&](Controller& c) { c.enableGPIOPins(); }, [&] { state_.gpioPinsEnabled = true; });
+    }
+
+    void disableGPIOPins() override {
+        set([&](Controller& c) { c.disableGPIOPins(); }, [&] { state_.gpioPinsEnabled = false; });
+    }
+
+    bool gpioPinsEnabled() noexcept override {
+        std::lock_guard<std::mutex> lock(mx_);
+        return up_ ? inner_->gpioPinsEnabled() : state_.gpioPinsEnabled.value_or(false);
+    }
+
+    std::vector<GPIOPin> getGPIOPins() override { return get([&](Controller& c) { return c.getGPIOPins(); }); }
+    GPIOPin getGPIOPin(const std::string& id) override { return get([&](Controller& c) { return c.getGPIOPin(id); }); }
+
+    void setGPIOPin(const std::string& id, bool on) override {
+        set([&](Controller& c) { c.setGPIOPin(id, on); }, [&] { state_.gpioPins[id] = on; });
+    }
+
+    float temperature() override { return get([&](Controller& c) { return c.temperature(); }); }
+    void powerReset() override { get([&](Controller& c) { c.powerReset(); return 0; }); }
+
+    void close() noexcept override {
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            if (closed_) {
+                return;
+            }
+            closed_ = true;
+        }
+        cv_.notify_all();
+        if (worker_.joinable()) {
+            worker_.join();
+        }
+        std::unique_lock<std::mutex> lock(mx_);
+        cv_.wait(lock, [this] { return calls_ == 0; });
+        if (innerOpen_) {
+            innerOpen_ = false;
+            inner_->close();
+        }
+    }
+
+private:
+    struct LEDState {
+        std::optional<bool> on;
+        std::optional<int>  brightness;
+        std::optional<bool> strobeOn;
+        std::optional<int>  strobeDelay;
+    };
+
+    // The last known state of the controller.
+    struct State {
+        std::optional<StatusLEDState> statusLED;
+        std::optional<long long int>  blinkingDuration;
+        std::optional<bool>           gpioPinsEnabled;
+        std::map<std::string, LEDState> leds;
+        std::map<std::string, bool>     switches;
+        std::map<std::string, bool>     gpioPins;
+
+        // Moves buffered while disconnected. The flag marks absolute moves.
+        std::map<std::string, std::pair<bool, int>> moves;
+    };
+
+    Exception disconnected() const {
+        return Exception(Exception::Generic, "controller disconnected");
+    }
+
+    // Counts a call on the current connection, so that it is not closed before the call returned.
+    class Call {
+    public:
+        explicit Call(SupervisedController& s) : s_(s) {}
+        ~Call() {
+            std::lock_guard<std::mutex> lock(s_.mx_);
+            if (--s_.calls_ == 0) {
+                s_.cv_.notify_all();
+            }
+        }
+
+    private:
+        SupervisedController& s_;
+    };
+
+    // Returns the current connection and counts the call, or throws, if disconnected. Requires mx_.
+    Controller::Ptr connection() {
+        if (!up_ || closed_) {
+            throw disconnected();
+        }
+        calls_++;
+        return inner_;
+    }
+
+    template<typename F>
+    std::invoke_result_t<F, Controller&> get(F fn) {
+        Controller::Ptr c;
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            c = connection();
+        }
+        Call call(*this);
+        try {
+            return fn(*c);
+        } catch (Exception& e) {
+            check(c, e);
+            throw;
+        }
+    }
+
+    // Calls fn, if connected, and records the state. Otherwise, the call is buffered or fails.
+    template<typename F>
+    void set(F fn, std::function<void()> record, std::function<void()> buffer = nullptr) {
+        Controller::Ptr c;
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            if (closed_) {
+                throw disconnected();
+            }
+            if (!up_) {
+                if (!opts_.buffer) {
+                    throw disconnected();
+                }
+                (buffer ? buffer : record)();
+                stats_.buffered++;
+                return;
+            }
+            c = connection();
+        }
+
+        Call call(*this);
+        try {
+            fn(*c);
+        } catch (Exception& e) {
+            check(c, e);
+            throw;
+        }
+
+        if (record) {
+            std::lock_guard<std::mutex> lock(mx_);
+            record();
+        }
+    }
+
+    // Probes the connection after a failed call, as the failure may also be caused by invalid arguments.
+    void check(Controller::Ptr c, Exception& e) {
+        if (e.code() != Exception::Generic) {
+            return;
+        }
+        try {
+            opts_.probe(*c);
+        } catch (Exception&) {
+            down(c);
+        }
+    }
+
+    void down(Controller::Ptr c) {
+        {
+            std::lock_guard<std::mutex> lock(mx_);
+            if (!up_ || inner_ != c) {
+                return;
+            }
+            up_ = false;
+            stats_.disconnects++;
+        }
+        cv_.notify_all();
+    }
+
+    void run() {
+        auto backoff = opts_.minBackoff;
+        bool reported = true;
+        std::unique_lock<std::mutex> lock(mx_);
+        while (!closed_) {
+            if (up_ != reported) {
+                reported = up_;
+                notify(lock, reported);
+                continue;
+            }
+
+            if (up_) {
+                if (cv_.wait_for(lock, opts_.heartbeat, [this] { return closed_ || !up_; })) {
+                    continue;
+                }
+                Controller::Ptr c = inner_;
+                lock.unlock();
+                try {
+                    opts_.probe(*c);
+                } catch (Exception&) {
+                    down(c);
+                }
+                lock.lock();
+                continue;
+            }
+
+            // Disconnected: reopen with backoff. The lost controller is closed once, before the first attempt,
+            // after the calls still running on it returned.
+            cv_.wait(lock, [this] { return calls_ == 0; });
+            Controller::Ptr old = innerOpen_ ? inner_ : nullptr;
+            innerOpen_ = false;
+            stats_.attempts++;
+            lock.unlock();
+            if (old) {
+                old->close();
+            }
+            Controller::Ptr c;
+            try {
+                c = opener_();
+            } catch (Exception&) {
+            }
+            lock.lock();
+
+            if (c) {
+                std::vector<std::pair<std::string, Exception>> dropped;
+                bool ok = false;
+                try {
+                    replay(*c, dropped);
+                    inner_ = c;
+                    innerOpen_ = true;
+                    up_ = true;
+                    stats_.reconnects++;
+                    backoff = opts_.minBackoff;
+                    ok = true;
+                } catch (Exception&) {
+                    c->close();
+                }
+                stats_.dropped += dropped.size();
+                if (!dropped.empty() && opts_.onDropped) {
+                    lock.unlock();
+                    for (const auto& [call, e] : dropped) {
+                        opts_.onDropped(call, e);
+                    }
+                    lock.lock();
+                }
+                if (ok) {
+                    continue;
+                }
+            }
+            cv_.wait_for(lock, backoff, [this] { return closed_; });
+            backoff = std::min(opts_.maxBackoff, backoff * 2);
+        }
+    }
+
+    // Reports a connection change without holding the lock.
+    void notify(std::unique_lock<std::mutex>& lock, bool connected) {
+        lock.unlock();
+        cv_.notify_all();
+        if (opts_.onConnectionChange) {
+            opts_.onConnectionChange(connected);
+        }
+        lock.lock();
+    }
+
+    // Applies the last known state to a new connection. Called with the lock held,
+    // so that no other call reaches the controller before the replay is complete.
+    // Entries the controller rejects are removed from the state and added to dropped.
+    // Buffered moves are removed as soon as they are applied, so that a retry does not repeat them.
+    void replay(Controller& c, std::vector<std::pair<std::string, Exception>>& dropped) {
+        // Enabling or disabling fails, if the pins already are in that state.
+        if (state_.gpioPinsEnabled && *state_.gpioPinsEnabled != c.gpioPinsEnabled()) {
+            bool enable = *state_.gpioPinsEnabled;
+            if (!apply(c, dropped, enable ? "enableGPIOPins" : "disableGPIOPins",
+                       [&] { enable ? c.enableGPIOPins() : c.disableGPIOPins(); })) {
+                state_.gpioPinsEnabled.reset();
+            }
+        }
+        if (state_.statusLED && !apply(c, dropped, "setStatusLED", [&] { c.setStatusLED(*state_.statusLED); })) {
+            state_.statusLED.reset();
+        }
+        if (state_.blinkingDuration &&
+            !apply(c, dropped, "setStatusLEDBlinkingDuration", [&] { c.setStatusLEDBlinkingDuration(*state_.blinkingDuration); })) {
+            state_.blinkingDuration.reset();
+        }
+        for (auto it = state_.leds.begin(); it != state_.leds.end();) {
+            const std::string& id = it->first;
+            LEDState& led = it->second;
+            if (led.brightness && !apply(c, dropped, "setLEDBrightness(" + id + ")", [&] { c.setLEDBrightness(id, *led.brightness); })) {
+                led.brightness.reset();
+            }
+            if (led.strobeDelay && !apply(c, dropped, "setLEDStrobeDelay(" + id + ")", [&] { c.setLEDStrobeDelay(id, *led.strobeDelay); })) {
+                led.strobeDelay.reset();
+            }
+            if (led.strobeOn && !apply(c, dropped, "setLEDStrobe(" + id + ")", [&] { c.setLEDStrobe(id, *led.strobeOn); })) {
+                led.strobeOn.reset();
+            }
+            if (led.on && !apply(c, dropped, "setLED(" + id + ")", [&] { c.setLED(id, *led.on); })) {
+                led.on.reset();
+            }
+            it = led.brightness || led.strobeDelay || led.strobeOn || led.on ? std::next(it) : state_.leds.erase(it);
+        }
+        for (auto it = state_.switches.begin(); it != state_.switches.end();) {
+            bool ok = apply(c, dropped, "setSwitch(" + it->first + ")", [&] { c.setSwitch(it->first, it->second); });
+            it = ok ? std::next(it) : state_.switches.erase(it);
+        }
+        if (c.gpioPinsEnabled()) {
+            for (auto it = state_.gpioPins.begin(); it != state_.gpioPins.end();) {
+                bool ok = apply(c, dropped, "setGPIOPin(" + it->first + ")", [&] { c.setGPIOPin(it->first, it->second); });
+                it = ok ? std::next(it) : state_.gpioPins.erase(it);
+            }
+        }
+        for (auto it = state_.moves.begin(); it != state_.moves.end();) {
+            const std::string& id = it->first;
+            auto [absolute, step] = it->second;
+            if (absolute) {
+                apply(c, dropped, "setStepMotorAbsPos(" + id + ")", [&] { c.setStepMotorAbsPos(id, step); });
+            } else if (step != 0) {
+                apply(c, dropped, "setStepMotorRelPos(" + id + ")", [&] { c.setStepMotorRelPos(id, step); });
+            }
+            it = state_.moves.erase(it);
+        }
+    }
+
+    // Applies a recorded call. Returns false, if the controller rejected it, because the id is unknown
+    // or the probe shows that the connection works and the call itself failed.
+    // Throws, if the connection failed.
+    template<typename F>
+    bool apply(Controller& c, std::vector<std::pair<std::string, Exception>>& dropped, const std::string& call, F fn) {
+        try {
+            fn();
+            return true;
+        } catch (Exception& e) {
+            if (e.code() != Exception::NotFound) {
+                opts_.probe(c);
+            }
+            dropped.emplace_back(call, e);
+            return false;
+        }
+    }
+
+    Opener                  opener_;
+    SupervisorOpts          opts_;
+    State                   state_;
+    SupervisorStats         stats_ = {};
+    bool                    up_        = true;
+    bool                    closed_    = false;
+    bool                    innerOpen_ = true;
+    int                     calls_     = 0; // Calls running on inner_ without holding the lock.
+    std::mutex              mx_;
+    std::condition_variable cv_;
+    std::thread             worker_;
+};
+
+}
+
+#endif
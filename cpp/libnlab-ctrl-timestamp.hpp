@@ -0,0 +1,107 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+/// \file
+/// \brief Contains the TimestampedReader, that stamps controller readings with the host clock.
+///
+/// The controller does not expose a clock of its own, so readings are placed on the host's
+/// std::chrono::steady_clock (CLOCK_MONOTONIC on Linux) by bracketing each request:
+/// the state was sampled at some point between sending the request and receiving the response.
+/// A reading is stamped with the middle of that interval, and half its length is a strict error bound.
+#ifndef NLAB_CTRL_LIB_TIMESTAMP_HPP
+#define NLAB_CTRL_LIB_TIMESTAMP_HPP
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <type_traits>
+
+#include <libnlab-ctrl.hpp>
+
+namespace nlab::ctrl {
+
+/// \brief A value read from the controller, together with the time it was sampled.
+template<typename T>
+struct Timestamped {
+    T                                     value; ///< The value.
+    std::chrono::steady_clock::time_point time;  ///< The estimated time the value was sampled.
+    std::chrono::nanoseconds              error; ///< The value was sampled within time ± error.
+};
+
+/// \brief Statistics of the round trips of a TimestampedReader.
+struct TimestampStats {
+    uint64_t                 samples; ///< Number of readings.
+    std::chrono::nanoseconds minRTT;  ///< The shortest round trip seen.
+    std::chrono::nanoseconds meanRTT; ///< The moving average of the round trips.
+};
+
+/// \brief Reads controller state with host timestamps and error bounds.
+///
+/// All methods may be called from any thread.
+class TimestampedReader {
+public:
+    /// \brief Creates a reader for the controller.
+    explicit TimestampedReader(Controller::Ptr ctrl) : ctrl_(ctrl) {}
+
+    /// \brief Calls fn with the controller and stamps its result.
+    ///
+    /// \throws Exception
+    template<typename F>
+    Timestamped<std::invoke_result_t<F, Controller&>> read(F fn) {
+        auto start = std::chrono::steady_clock::now();
+        auto value = fn(*ctrl_);
+        auto end = std::chrono::steady_clock::now();
+        record(end - start);
+        return {std::move(value), start + (end - start) / 2, (end - start) / 2};
+    }
+
+    /// \brief Timestamped variant of Controller::getStepMotors().
+    Timestamped<std::vector<StepMotor>> getStepMotors() { return read([](Controller& c) { return c.getStepMotors(); }); }
+    /// \brief Timestamped variant of Controller::getStepMotor().
+    Timestamped<StepMotor> getStepMotor(const std::string& id) { return read([&](Controller& c) { return c.getStepMotor(id); }); }
+    /// \brief Timestamped variant of Controller::getLEDs().
+    Timestamped<std::vector<LED>> getLEDs() { return read([](Controller& c) { return c.getLEDs(); }); }
+    /// \brief Timestamped variant of Controller::getLED().
+    Timestamped<LED> getLED(const std::string& id) { return read([&](Controller& c) { return c.getLED(id); }); }
+    /// \brief Timestamped variant of Controller::getSwitches().
+    Timestamped<std::vector<Switch>> getSwitches() { return read([](Controller& c) { return c.getSwitches(); }); }
+    /// \brief Timestamped variant of Controller::getSwitch().
+    Timestamped<Switch> getSwitch(const std::string& id) { return read([&](Controller& c) { return c.getSwitch(id); }); }
+    /// \brief Timestamped variant of Controller::getGPIOPins().
+    Timestamped<std::vector<GPIOPin>> getGPIOPins() { return read([](Controller& c) { return c.getGPIOPins(); }); }
+    /// \brief Timestamped variant of Controller::getGPIOPin().
+    Timestamped<GPIOPin> getGPIOPin(const std::string& id) { return read([&](Controller& c) { return c.getGPIOPin(id); }); }
+    /// \brief Timestamped variant of Controller::temperature().
+    Timestamped<float> temperature() { return read([](Controller& c) { return c.temperature(); }); }
+
+    /// \brief Returns the round trip statistics.
+    TimestampStats stats() {
+        std::lock_guard<std::mutex> lock(mx_);
+        return stats_;
+    }
+
+private:
+    void record(std::chrono::nanoseconds rtt) {
+        std::lock_guard<std::mutex> lock(mx_);
+        if (stats_.samples == 0 || rtt < stats_.minRTT) {
+            stats_.minRTT = rtt;
+        }
+        // Exponential moving average with a weight of 1/16.
+        stats_.meanRTT = stats_.samples == 0 ? rtt : stats_.meanRTT + (rtt - stats_.meanRTT) / 16;
+        stats_.samples++;
+    }
+
+    Controller::Ptr ctrl_;
+    TimestampStats  stats_ = {};
+    std::mutex      mx_;
+};
+
+}
+
+#endif
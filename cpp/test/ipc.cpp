@@ -0,0 +1,78 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+// IPC test of the Server and the RemoteController against the dummy backend.
+//
+// Commits a batch, whose responses exceed the output limit of the server, and checks,
+// that a second server does not take over the socket of a running one.
+// Exits with 1, if a check failed.
+
+#include <string>
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <future>
+
+#include <libnlab-ctrl-ipc.hpp>
+
+using namespace std;
+using namespace nlab::ctrl;
+
+static const string socketPath = "/tmp/nlab-ctrl-ipc-test.sock";
+static int failed = 0;
+
+static void expect(bool ok, const string& what) {
+    cout << (ok ? "ok      " : "FAILED  ") << what << endl;
+    failed += !ok;
+}
+
+int main() {
+    try {
+        ipc::Server server(socketPath);
+        thread worker([&] { server.run(); });
+
+        {
+            Controller::Ptr c = ipc::open("dummy", "", ControllerOpts(), socketPath);
+            auto rc = dynamic_pointer_cast<ipc::RemoteController>(c);
+
+            // Every response takes several bytes, so the responses of the batch exceed ipc::MaxPendingOutput.
+            const int n = 1000000;
+            auto commit = async(launch::async, [&] {
+                rc->beginBatch();
+                for (int i = 0; i < n; ++i) {
+                    rc->setLEDBrightness("led1", i % 100);
+                }
+                rc->commitBatch();
+            });
+            bool done = commit.wait_for(chrono::seconds(60)) == future_status::ready;
+            expect(done, "batch beyond the output limit committed");
+            if (!done) {
+                cout << "server deadlocked" << endl;
+                _exit(1);
+            }
+            commit.get();
+            expect(c->getLED("led1").brightness == (n - 1) % 100, "last write of the batch applied");
+
+            bool rejected = false;
+            try {
+                ipc::Server second(socketPath);
+            } catch (Exception&) {
+                rejected = true;
+            }
+            expect(rejected, "second server rejected");
+            expect(c->getLED("led1").brightness == (n - 1) % 100, "first server still serves");
+            c->close();
+        }
+
+        server.stop();
+        worker.join();
+    } catch (Exception& e) {
+        cout << "exception! code: " << to_string(e.code()) << ", message: " << e.what() << endl;
+        return 1;
+    }
+    return failed > 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * controller-libs
+ * Copyright (c) 2021 Wahtari GmbH
+ *
+ * All source code in this file is subject to the included LICENSE file.
+ */
+
+// Reconnect test of the SupervisedController against the dummy backend.
+//
+// Simulates unplugging and replugging the controller and checks, that the supervisor reconnects
+// and replays the gpio pin state, both with enabled and with disabled gpio pins,
+// that it retries, if the replay fails, and that buffered calls are replayed at most once
+// and dropped, if the controller rejects them.
+// Exits with 1, if a check failed.
+
+#include <string>
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#include <libnlab-ctrl-supervisor.hpp>
+
+using namespace std;
+using namespace nlab::ctrl;
+
+static atomic<bool> unplugged{false};
+static atomic<bool> failSetters{false};
+static atomic<bool> failMoveOnce{false};
+static atomic<int>  moved{0};
+static int failed = 0;
+
+// A controller that fails every call, while the device is unplugged.
+class Unpluggable : public ForwardingController {
+public:
+    using ForwardingController::ForwardingController;
+
+    vector<LED> getLEDs() override {
+        check();
+        if (failSetters) {
+            throw Exception(Exception::Generic, "device not responding");
+        }
+        return inner_->getLEDs();
+    }
+    void setGPIOPin(const string& id, bool on) override {
+        check();
+        if (failSetters) {
+            throw Exception(Exception::Generic, "device not responding");
+        }
+        inner_->setGPIOPin(id, on);
+    }
+    // The connection drops during the first move of step2, after step1 moved.
+    void setStepMotorRelPos(const string& id, int step) override {
+        check();
+        if (id == "step2" && failMoveOnce.exchange(false)) {
+            unplugged = true;
+            throw Exception(Exception::Generic, "device unplugged");
+        }
+        inner_->setStepMotorRelPos(id, step);
+        moved += step;
+    }
+    GPIOPin getGPIOPin(const string& id) override { check(); return inner_->getGPIOPin(id); }
+
+private:
+    void check() {
+        if (unplugged) {
+            throw Exception(Exception::Generic, "device unplugged");
+        }
+    }
+};
+
+static void expect(bool ok, const string& what) {
+    cout << (ok ? "ok      " : "FAILED  ") << what << endl;
+    failed += !ok;
+}
+
+static bool waitConnected(SupervisedController& s, bool connected) {
+    for (int i = 0; i < 200; ++i) {
+        if (s.connected() == connected) {
+            return true;
+        }
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    return false;
+}
+
+// Unplugs the device until the supervisor noticed, then replugs it and waits for the reconnect.
+// With failReplay, the replay fails for a while after replugging.
+static bool reconnect(SupervisedController& s, bool failReplay = false) {
+    unplugged = true;
+    try {
+        s.getLEDs();
+    } catch (Exception&) {}
+    bool down = waitConnected(s, false);
+    failSetters = failReplay;
+    unplugged = false;
+    if (failReplay) {
+        this_thread::sleep_for(chrono::milliseconds(100));
+        down = down && !s.connected();
+        failSetters = false;
+    }
+    return down && waitConnected(s, true);
+}
+
+int main() {
+    SupervisorOpts opts;
+    opts.heartbeat  = chrono::milliseconds(20);
+    opts.minBackoff = chrono::milliseconds(10);
+
+    auto opener = [] {
+        if (unplugged) {
+            throw Exception(Exception::Generic, "device unplugged");
+        }
+        return make_shared<Unpluggable>(Controller::open("dummy", "", ControllerOpts()));
+    };
+
+    try {
+        SupervisedController s(opener, opts);
+
+        // Enabled pins: the pin state is replayed.
+        s.enableGPIOPins();
+        s.setGPIOPin("gpio-3", true);
+        expect(reconnect(s), "reconnect with enabled gpio pins");
+        expect(s.gpioPinsEnabled(), "gpio pins enabled after reconnect");
+        expect(s.getGPIOPin("gpio-3").on, "gpio pin replayed after reconnect");
+
+        // Disabled pins: the replay must neither disable them again nor set the pins.
+        s.disableGPIOPins();
+        expect(reconnect(s), "reconnect with disabled gpio pins");
+        expect(!s.gpioPinsEnabled(), "gpio pins disabled after reconnect");
+        expect(s.stats().reconnects == 2, "two reconnects counted");
+
+        // A failed replay closes the new controller and tries again.
+        s.enableGPIOPins();
+        s.setGPIOPin("gpio-4", true);
+        expect(reconnect(s, true), "reconnect after failed replays");
+        expect(s.getGPIOPin("gpio-4").on, "gpio pin replayed after failed replays");
+
+        // Buffered calls: a rejected one is dropped, a move is not repeated by a retry.
+        SupervisorOpts bopts = opts;
+        bopts.buffer = true;
+        int drops = 0;
+        bopts.onDropped = [&](const string&, const Exception&) { drops++; };
+        SupervisedController b(opener, bopts);
+        unplugged = true;
+        try {
+            b.getLEDs();
+        } catch (Exception&) {}
+        expect(waitConnected(b, false), "buffering supervisor disconnected");
+        b.setLEDBrightness("nonexistent", 50);
+        b.setStepMotorRelPos("step1", 10);
+        b.setStepMotorRelPos("step2", 5);
+        failMoveOnce = true;
+        unplugged = false;
+        this_thread::sleep_for(chrono::milliseconds(100));
+        unplugged = false;
+        expect(waitConnected(b, true), "reconnect with rejected buffered calls");
+        // The dummy backend starts every connection at the same position, so count the steps sent instead.
+        expect(moved == 10, "buffered move applied once");
+        expect(b.stats().dropped == 2 && drops == 2, "rejected buffered calls dropped");
+    } catch (Exception& e) {
+        cout << "exception! code: " << to_string(e.code()) << ", message: " << e.what() << endl;
+        return 1;
+    }
+    return failed > 0;
+}